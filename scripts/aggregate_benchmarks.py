@@ -31,8 +31,10 @@ def run_case(case):
     result = subprocess.run(['./benchmark', *map(str, case)], capture_output=True, check=True)
     labeled, input_bits, sender_size, receiver_size, poly_modulus_degree, partition_count, window_size, iteration_count = case
     lines = [x for x in result.stdout.decode().split('\n') if (len(x) > 0)]
-    # the last element of the tuple is (matches / receiver_size)
-    runs = [(float(x[0]), float(x[1]), float(x[2]), int(x[3]) / case[3])
+    # the fourth element of the tuple is (matches / receiver_size), the rest
+    # are the query's and the response's bytes on the wire, unpacked and packed
+    runs = [(float(x[0]), float(x[1]), float(x[2]), int(x[3]) / case[3],
+             int(x[4]) / 2**10, int(x[5]) / 2**10, int(x[6]) / 2**10, int(x[7]) / 2**10)
             for x in (y.split('\t') for y in lines)]
 
     print('{it} runs of {la} N_x={nx}, N_y={ny} with SEAL{pmd}, alpha={al}, l={l}:'.format(
@@ -50,7 +52,17 @@ def run_case(case):
         l_avg = avg(l)
         return math.sqrt(sum((x - l_avg)**2 for x in l) / (len(l) - 1))
 
-    for (index, name) in enumerate(['sender, s', 'receiver enc, s', 'receiver dec, s', 'matches, %']):
+    names = [
+        'sender, s',
+        'receiver enc, s',
+        'receiver dec, s',
+        'matches, %',
+        'query unpacked, KiB',
+        'query packed, KiB',
+        'response unpacked, KiB',
+        'response packed, KiB',
+    ]
+    for (index, name) in enumerate(names):
         values = [x[index] for x in runs]
         print('{name}: avg {avg:.2f}, stddev {stddev:.2f}, min {min:.2f}, max {max:.2f}'.format(
             name=name,
@@ -60,6 +72,11 @@ def run_case(case):
             max=max(values)
         ))
 
+    total_unpacked = sum(x[4] + x[6] for x in runs)
+    total_packed = sum(x[5] + x[7] for x in runs)
+    print('packing saves {:.1f}% of the bytes on the wire'.format(
+        100 * (1 - total_packed / total_unpacked)))
+
     print()
 
 def main():
@@ -0,0 +1,41 @@
+#include <cassert>
+
+#include "admission.h"
+
+Admission::Admission(AdmissionControl &control, size_t memory_bytes)
+    : control(control), memory_bytes(memory_bytes)
+{}
+
+Admission::~Admission()
+{
+    control.release(memory_bytes);
+}
+
+AdmissionControl::AdmissionControl(size_t memory_budget, double max_query_seconds)
+    : memory_budget(memory_budget), memory_used(0), max_query_seconds(max_query_seconds)
+{}
+
+AdmissionResult AdmissionControl::admit(size_t memory_bytes,
+                                        double query_seconds,
+                                        unique_ptr<Admission> &admission)
+{
+    // a session that could never fit is too expensive, not just unlucky.
+    if ((query_seconds > max_query_seconds) || (memory_bytes > memory_budget)) {
+        return REJECTED_TOO_EXPENSIVE;
+    }
+
+    lock_guard<mutex> lock(memory_mutex);
+    if (memory_used + memory_bytes > memory_budget) {
+        return REJECTED_BUSY;
+    }
+    memory_used += memory_bytes;
+    admission = make_unique<Admission>(*this, memory_bytes);
+    return ADMITTED;
+}
+
+void AdmissionControl::release(size_t memory_bytes)
+{
+    lock_guard<mutex> lock(memory_mutex);
+    assert(memory_bytes <= memory_used);
+    memory_used -= memory_bytes;
+}
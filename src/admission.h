@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+/*
+AdmissionControl decides whether the sender takes on a new session, based on
+the cost model's estimate of the session's queries (see QueryCost):
+
+- a session whose queries alone would take longer than max_query_seconds is
+  rejected outright, since it would hold up everyone else's queries.
+- every admitted session keeps the powers of its queries in memory until it
+  ends, and the total memory for powers is capped. a session that doesn't fit
+  into what's left is rejected until other sessions have ended, instead of
+  making every session slower (or running out of memory).
+*/
+
+enum AdmissionResult
+{
+    ADMITTED,
+    REJECTED_TOO_EXPENSIVE,
+    REJECTED_BUSY,
+};
+
+class AdmissionControl;
+
+/* an admitted session's share of the memory, which is given back when the
+   Admission is destroyed. */
+class Admission
+{
+public:
+    Admission(AdmissionControl &control, size_t memory_bytes);
+    ~Admission();
+
+private:
+    AdmissionControl &control;
+    size_t memory_bytes;
+};
+
+class AdmissionControl
+{
+public:
+    AdmissionControl(size_t memory_budget, double max_query_seconds);
+
+    /* if the result is ADMITTED, admission holds the session's memory. safe to
+       call from multiple threads. */
+    AdmissionResult admit(size_t memory_bytes, double query_seconds, unique_ptr<Admission> &admission);
+
+private:
+    friend class Admission;
+    void release(size_t memory_bytes);
+
+    mutex memory_mutex;
+    size_t memory_budget;
+    size_t memory_used;
+    double max_query_seconds;
+};
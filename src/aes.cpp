@@ -46,3 +46,28 @@ pair<uint64_t, uint64_t> AES::encrypt(uint64_t block_high, uint64_t block_low)
 
     return make_pair(result[1], result[0]);
 }
+
+void AES::encrypt_low(uint64_t block_high, const uint64_t *blocks_low, size_t count, uint64_t *results_low)
+{
+    size_t i = 0;
+    for (; i + AES_BATCH_SIZE <= count; i += AES_BATCH_SIZE) {
+        // the blocks are independent, so the processor can work on all of
+        // them at once, instead of waiting for every round of one block.
+        __m128i ciphertexts[AES_BATCH_SIZE];
+        for (size_t k = 0; k < AES_BATCH_SIZE; k++) {
+            ciphertexts[k] = _mm_xor_si128(_mm_set_epi64x(block_high, blocks_low[i + k]), round_key[0]);
+        }
+        for (size_t round = 1; round < 10; round++) {
+            for (size_t k = 0; k < AES_BATCH_SIZE; k++) {
+                ciphertexts[k] = _mm_aesenc_si128(ciphertexts[k], round_key[round]);
+            }
+        }
+        for (size_t k = 0; k < AES_BATCH_SIZE; k++) {
+            ciphertexts[k] = _mm_aesenclast_si128(ciphertexts[k], round_key[10]);
+            results_low[i + k] = _mm_cvtsi128_si64(ciphertexts[k]);
+        }
+    }
+    for (; i < count; i++) {
+        results_low[i] = encrypt(block_high, blocks_low[i]).second;
+    }
+}
@@ -2,6 +2,7 @@
    in Peter Rindal's cryptoTools:
    https://github.com/ladnir/cryptoTools/blob/master/cryptoTools/Crypto/AES.h */
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <utility>
 
@@ -9,12 +10,18 @@
 
 using namespace std;
 
+const size_t AES_BATCH_SIZE = 8;
+
 class AES
 {
 public:
         AES();
         void set_key(uint64_t key_high, uint64_t key_low);
         pair<uint64_t, uint64_t> encrypt(uint64_t block_high, uint64_t block_low);
+        /* encrypts the blocks (block_high, blocks_low[i]) for every i < count
+           and writes the low halves of the results. AES_BATCH_SIZE blocks are
+           encrypted at a time, so that their rounds overlap in the pipeline. */
+        void encrypt_low(uint64_t block_high, const uint64_t *blocks_low, size_t count, uint64_t *results_low);
 
 private:
         __m128i round_key[11];
@@ -1,19 +1,49 @@
 #include <chrono>
 #include <iostream>
-#include <set>
+#include <string>
 #include <vector>
 
+#include "memory_pools.h"
+#include "networking.h"
+#include "powers_dag.h"
 #include "psi.h"
 #include "random.h"
 #include "test_utils.h"
 
 using namespace std;
 
+// the number of bytes it takes to send the ciphertexts.
+size_t wire_size(PSIParams &params, vector<Ciphertext> &ciphertexts, bool packed)
+{
+    size_t size = 0;
+    for (auto &ciphertext : ciphertexts) {
+        size += Networking::ciphertext_size(params.context, ciphertext, packed);
+    }
+    return size;
+}
+
 int main(int argc, char** argv)
 {
-    if (argc != 9) {
+    // the options come first.
+    uint64_t seed = 0;
+    string cache_directory;
+    while ((argc >= 3) && (argv[1][0] == '-')) {
+        string option = argv[1];
+        if (option == "--seed") {
+            seed = stoull(argv[2]);
+        } else if (option == "--cache") {
+            cache_directory = argv[2];
+        } else {
+            break;
+        }
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    if ((argc != 9) && (argc != 10)) {
         cout << "USAGE:" << endl;
-        cout << argv[0] << " labeled" // argv[1]
+        cout << argv[0] << " [--seed seed] [--cache directory]"
+                        << " label_columns" // argv[1]
                         << " inputs_bits" // argv[2]
                         << " sender_size" // argv[3]
                         << " receiver_size" // argv[4]
@@ -21,11 +51,20 @@ int main(int argc, char** argv)
                         << " partition_count" // argv[6]
                         << " window_size" // argv[7]
                         << " iteration_count" // argv[8]
+                        << " [power_basis_depth]" // argv[9]
                         << endl;
+        cout << "every item gets label_columns labels, each as wide as the"
+             << " inputs, or none if it's 0." << endl;
+        cout << "if power_basis_depth is given, window_size is ignored and the"
+             << " receiver sends a power basis planned for that depth." << endl;
+        cout << "the sets only depend on the seed (0 by default) and the sizes,"
+             << " so they're generated once for all iterations, and if a cache"
+             << " directory is given, kept there for later runs." << endl;
         return 1;
     }
 
-    bool labeled = (atol(argv[1]) != 0);
+    size_t label_columns = atol(argv[1]);
+    bool labeled = (label_columns != 0);
     size_t input_bits = atol(argv[2]);
     size_t sender_size = atol(argv[3]);
     size_t receiver_size = atol(argv[4]);
@@ -33,82 +72,99 @@ int main(int argc, char** argv)
     size_t partition_count = atol(argv[6]);
     size_t window_size = atol(argv[7]);
     size_t iteration_count = atol(argv[8]);
+    optional<size_t> power_basis_depth;
+    if (argc == 10) {
+        power_basis_depth = atol(argv[9]);
+    }
 
-    auto random_factory = UniformRandomGeneratorFactory::default_factory();
-    auto random = random_factory->create();
-
-    vector<uint64_t> sender_inputs(sender_size);
-    vector<uint64_t> sender_labels(sender_size);
-    vector<uint64_t> receiver_inputs(receiver_size);
-
-    for (size_t i = 0; i < iteration_count; i++) {
-        // generate random inputs
-        generate_random_sender_set(random, sender_inputs, input_bits);
-        if (labeled) {
-            generate_random_labels(random, sender_labels, input_bits);
+    // half of the receiver's inputs are in the sender's set.
+    Dataset dataset;
+    {
+        ThreadPool pool;
+        auto dataset_start = std::chrono::steady_clock::now();
+        if (cache_directory.empty()) {
+            generate_dataset(seed, input_bits, sender_size, receiver_size, 50, label_columns, input_bits,
+                             pool, dataset);
+        } else {
+            load_dataset(cache_directory, seed, input_bits, sender_size, receiver_size, 50, label_columns,
+                         input_bits, pool, dataset);
         }
+        std::chrono::duration<double> dataset_duration = std::chrono::steady_clock::now() - dataset_start;
+        cerr << "sets ready in " << dataset_duration.count() << " s" << endl;
+    }
+    vector<uint64_t> &sender_inputs = dataset.sender_inputs;
+    vector<vector<uint64_t>> &sender_labels = dataset.sender_labels;
+    vector<uint64_t> &receiver_inputs = dataset.receiver_inputs;
 
-        generate_random_receiver_set(random, receiver_inputs, sender_inputs, input_bits, 50);
-
+    for (size_t i = 0; i < iteration_count; i++) {
         // generate params
         PSIParams params(receiver_size, sender_size, input_bits, poly_modulus_degree);
         params.set_sender_partition_count(partition_count);
         params.set_window_size(window_size);
+        if (labeled) {
+            params.set_label_column_bits(vector<size_t>(label_columns, input_bits));
+        }
+        if (power_basis_depth.has_value()) {
+            params.set_power_basis(plan_power_basis(params.max_partition_size(), power_basis_depth.value()));
+        }
         params.generate_seeds();
 
         // do the actual benchmarking
         // phase 1: receiver encoding
-        auto receiver_enc_start = chrono::system_clock::now();
+        auto receiver_enc_start = std::chrono::system_clock::now();
 
         PSIReceiver user(params);
         vector<bucket_slot> receiver_buckets;
         auto receiver_encrypted_inputs = user.encrypt_inputs(receiver_inputs, receiver_buckets);
+        // the relin keys are part of the receiver's query, so the receiver
+        // pays for generating them.
+        RelinKeys relin_keys;
+        if (params.needs_relin_keys()) {
+            relin_keys = user.relin_keys();
+        }
 
-        auto receiver_enc_end = chrono::system_clock::now();
-        chrono::duration<double> receiver_enc_duration = receiver_enc_end - receiver_enc_start;
+        auto receiver_enc_end = std::chrono::system_clock::now();
+        std::chrono::duration<double> receiver_enc_duration = receiver_enc_end - receiver_enc_start;
 
         // phase 2: sender
-        auto sender_start = chrono::system_clock::now();
+        auto sender_start = std::chrono::system_clock::now();
 
         PSISender server(params);
-        optional<vector<uint64_t>> labels;
+        optional<vector<vector<uint64_t>>> labels;
         if (labeled) {
             labels = sender_labels;
         }
+        server.set_database(sender_inputs, labels);
         auto sender_matches = server.compute_matches(
-            sender_inputs,
-            labels,
             user.public_key(),
-            user.relin_keys(),
+            relin_keys,
             receiver_encrypted_inputs
         );
 
-        auto sender_end = chrono::system_clock::now();
-        chrono::duration<double> sender_duration = sender_end - sender_start;
+        auto sender_end = std::chrono::system_clock::now();
+        std::chrono::duration<double> sender_duration = sender_end - sender_start;
 
         // phase 3: receiver decoding
-        auto receiver_dec_start = chrono::system_clock::now();
-
-        vector<size_t> matches;
-        vector<pair<size_t, uint64_t>> labeled_matches;
-        size_t match_count;
+        auto receiver_dec_start = std::chrono::system_clock::now();
 
-        if (labeled) {
-            labeled_matches = user.decrypt_labeled_matches(sender_matches);
-            match_count = labeled_matches.size();
-        } else {
-            matches = user.decrypt_matches(sender_matches);
-            match_count = matches.size();
-        }
+        InputMatches matches;
+        user.decrypt_input_matches(sender_matches, receiver_buckets, matches);
+        size_t match_count = matches.inputs.size();
 
-        auto receiver_dec_end = chrono::system_clock::now();
-        chrono::duration<double> receiver_dec_duration = receiver_dec_end - receiver_dec_start;
+        auto receiver_dec_end = std::chrono::system_clock::now();
+        std::chrono::duration<double> receiver_dec_duration = receiver_dec_end - receiver_dec_start;
 
-        // output the timings
+        // output the timings, the bytes on the wire with and without
+        // bit-packing, and the bytes in the threads' memory pools.
         cout << sender_duration.count()
              << "\t" << receiver_enc_duration.count()
              << "\t" << receiver_dec_duration.count()
              << "\t" << match_count
+             << "\t" << wire_size(params, receiver_encrypted_inputs, false)
+             << "\t" << wire_size(params, receiver_encrypted_inputs, true)
+             << "\t" << wire_size(params, sender_matches, false)
+             << "\t" << wire_size(params, sender_matches, true)
+             << "\t" << thread_memory_pool_stats().allocated_bytes
              << endl;
     }
 
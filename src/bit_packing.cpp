@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "bit_packing.h"
+
+void pack_bits(const uint64_t *values, size_t count, size_t bit_count, uint8_t *destination)
+{
+    assert((bit_count > 0) && (bit_count <= 64));
+    assert(count % 8 == 0);
+    if (bit_count == 64) {
+        memcpy(destination, values, count * sizeof(uint64_t));
+        return;
+    }
+
+    // word holds the word_bits bits that haven't been written yet.
+    uint64_t word = 0;
+    size_t word_bits = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t value = values[i];
+        word |= value << word_bits;
+        word_bits += bit_count;
+        if (word_bits >= 64) {
+            memcpy(destination, &word, sizeof(word));
+            destination += sizeof(word);
+            word_bits -= 64;
+            // whatever didn't fit into the word we just wrote.
+            word = value >> (bit_count - word_bits);
+        }
+    }
+    // since count is a multiple of 8, the rest is a whole number of bytes.
+    memcpy(destination, &word, word_bits / 8);
+}
+
+// the word-at-a-time version of unpack_bits, for bit_count < 64.
+void unpack_bits_scalar(const uint8_t *source, size_t count, size_t bit_count, uint64_t *values)
+{
+    uint64_t mask = (1ull << bit_count) - 1;
+    const uint8_t *end = source + count * bit_count / 8;
+    // word holds the word_bits bits that have been read but not used yet.
+    uint64_t word = 0;
+    size_t word_bits = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (word_bits >= bit_count) {
+            values[i] = word & mask;
+            word >>= bit_count;
+            word_bits -= bit_count;
+        } else {
+            // the last word may be incomplete, so we must not read past it.
+            uint64_t next = 0;
+            size_t next_bytes = min(sizeof(next), static_cast<size_t>(end - source));
+            memcpy(&next, source, next_bytes);
+            source += next_bytes;
+
+            values[i] = (word | (next << word_bits)) & mask;
+            size_t used = bit_count - word_bits;
+            word = next >> used;
+            word_bits = 64 - used;
+        }
+    }
+}
+
+void unpack_bits(const uint8_t *source, size_t count, size_t bit_count, uint64_t *values)
+{
+    assert((bit_count > 0) && (bit_count <= 64));
+    assert(count % 8 == 0);
+    if (bit_count == 64) {
+        memcpy(values, source, count * sizeof(uint64_t));
+        return;
+    }
+
+    size_t unpacked = 0;
+#ifdef __AVX2__
+    // a value of at most 57 bits always lies within the 8 bytes starting at
+    // the byte it starts in, so we can gather 4 values at a time, shift them
+    // into place and mask off their neighbours. the last 8 values are left to
+    // the scalar version, so that the gathers never read past the end.
+    if ((bit_count >= 8) && (bit_count <= 57)) {
+        __m256i mask = _mm256_set1_epi64x((1ull << bit_count) - 1);
+        __m256i low_bits = _mm256_set1_epi64x(7);
+        __m256i step = _mm256_set1_epi64x(4 * bit_count);
+        __m256i bit_offsets = _mm256_set_epi64x(3 * bit_count, 2 * bit_count, bit_count, 0);
+        for (; unpacked + 8 < count; unpacked += 4) {
+            __m256i byte_offsets = _mm256_srli_epi64(bit_offsets, 3);
+            __m256i shifts = _mm256_and_si256(bit_offsets, low_bits);
+            __m256i words = _mm256_i64gather_epi64(
+                reinterpret_cast<const long long *>(source), byte_offsets, 1);
+            words = _mm256_and_si256(_mm256_srlv_epi64(words, shifts), mask);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(values + unpacked), words);
+            bit_offsets = _mm256_add_epi64(bit_offsets, step);
+        }
+    }
+#endif
+    // unpacked is a multiple of 8, so the rest starts at a whole byte.
+    unpack_bits_scalar(source + unpacked * bit_count / 8, count - unpacked, bit_count, values + unpacked);
+}
+
+size_t packed_ciphertext_size(shared_ptr<SEALContext> context, parms_id_type parms_id, size_t size)
+{
+    auto context_data = context->context_data(parms_id);
+    assert(context_data);
+    auto &parms = context_data->parms();
+    size_t coefficient_bits = 0;
+    for (auto &prime : parms.coeff_modulus()) {
+        coefficient_bits += prime.bit_count();
+    }
+    return size * parms.poly_modulus_degree() * coefficient_bits / 8;
+}
+
+size_t packed_ciphertext_size(shared_ptr<SEALContext> context, const Ciphertext &ciphertext)
+{
+    return packed_ciphertext_size(context, ciphertext.parms_id(), ciphertext.size());
+}
+
+void pack_ciphertext(shared_ptr<SEALContext> context, const Ciphertext &ciphertext, uint8_t *destination)
+{
+    auto &parms = context->context_data(ciphertext.parms_id())->parms();
+    size_t degree = parms.poly_modulus_degree();
+    auto &coeff_modulus = parms.coeff_modulus();
+
+    // every polynomial consists of one block of coefficients per prime.
+    for (size_t i = 0; i < ciphertext.size(); i++) {
+        const uint64_t *poly = ciphertext.data(i);
+        for (size_t j = 0; j < coeff_modulus.size(); j++) {
+            size_t bit_count = coeff_modulus[j].bit_count();
+            pack_bits(poly + j * degree, degree, bit_count, destination);
+            destination += degree * bit_count / 8;
+        }
+    }
+}
+
+void unpack_ciphertext(shared_ptr<SEALContext> context, const uint8_t *source, Ciphertext &ciphertext)
+{
+    auto &parms = context->context_data(ciphertext.parms_id())->parms();
+    size_t degree = parms.poly_modulus_degree();
+    auto &coeff_modulus = parms.coeff_modulus();
+
+    for (size_t i = 0; i < ciphertext.size(); i++) {
+        uint64_t *poly = ciphertext.data(i);
+        for (size_t j = 0; j < coeff_modulus.size(); j++) {
+            size_t bit_count = coeff_modulus[j].bit_count();
+            unpack_bits(source, degree, bit_count, poly + j * degree);
+            source += degree * bit_count / 8;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+#include "seal/seal.h"
+
+using namespace std;
+using namespace seal;
+
+/*
+Ciphertext coefficients are stored in 64-bit words, but every coefficient is
+reduced modulo one of the coeff_modulus primes, which are only 30-60 bits wide.
+Packing every coefficient to exactly the width of its prime saves 20-50% of the
+bytes, which is what we send over the network.
+
+Values are packed least significant bit first, into little-endian words, and
+every RNS component of a ciphertext is packed to the width of its own prime.
+Packing works a 64-bit word at a time. Unpacking, which the sender does for
+every query, gathers and shifts 4 values at a time with AVX2 if it's available.
+*/
+
+/* packs count values of bit_count bits each (the higher bits must be zero) into
+   count * bit_count / 8 bytes. count must be a multiple of 8. */
+void pack_bits(const uint64_t *values, size_t count, size_t bit_count, uint8_t *destination);
+void unpack_bits(const uint8_t *source, size_t count, size_t bit_count, uint64_t *values);
+
+/* the number of bytes the coefficients of a ciphertext with these parameters
+   take up when packed. */
+size_t packed_ciphertext_size(shared_ptr<SEALContext> context, parms_id_type parms_id, size_t size);
+size_t packed_ciphertext_size(shared_ptr<SEALContext> context, const Ciphertext &ciphertext);
+
+void pack_ciphertext(shared_ptr<SEALContext> context, const Ciphertext &ciphertext, uint8_t *destination);
+/* the ciphertext must already have the right parms_id and size. */
+void unpack_ciphertext(shared_ptr<SEALContext> context, const uint8_t *source, Ciphertext &ciphertext);
@@ -0,0 +1,39 @@
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "bitmap.h"
+
+size_t zero_bitmap(const uint64_t *values, size_t count, uint64_t *bitmap)
+{
+    size_t zeros = 0;
+    size_t i = 0;
+
+#ifdef __AVX2__
+    // every comparison yields the bits of 4 slots at once.
+    __m256i zero = _mm256_setzero_si256();
+    for (; i + 64 <= count; i += 64) {
+        uint64_t word = 0;
+        for (size_t k = 0; k < 64; k += 4) {
+            __m256i slots = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i + k));
+            __m256i equal = _mm256_cmpeq_epi64(slots, zero);
+            uint64_t bits = _mm256_movemask_pd(_mm256_castsi256_pd(equal));
+            word |= bits << k;
+        }
+        bitmap[i / 64] = word;
+        zeros += __builtin_popcountll(word);
+    }
+#endif
+
+    // without AVX2 (and for the rest), the comparisons are branch-free.
+    for (; i < count; i += 64) {
+        size_t word_count = (count - i < 64) ? (count - i) : 64;
+        uint64_t word = 0;
+        for (size_t k = 0; k < word_count; k++) {
+            word |= static_cast<uint64_t>(values[i + k] == 0) << k;
+        }
+        bitmap[i / 64] = word;
+        zeros += __builtin_popcountll(word);
+    }
+    return zeros;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+/*
+The receiver finds its matches by looking for the zeros among the slots of
+every decrypted partition. Almost all slots are nonzero, so instead of testing
+them one by one, zero_bitmap compares 4 slots at a time with AVX2 (if it's
+available) and collects the results into a bitmap, which can then be walked a
+word at a time, skipping 64 slots without matches at once.
+
+Bit i of a bitmap is bit i % 64 of its word i / 64.
+*/
+
+/* the number of words of a bitmap of count bits. */
+inline size_t bitmap_words(size_t count)
+{
+    return (count + 63) / 64;
+}
+
+/* sets bit i of bitmap if values[i] is zero and clears it otherwise, for every
+   i < count, and returns the number of zeros. */
+size_t zero_bitmap(const uint64_t *values, size_t count, uint64_t *bitmap);
+
+/* calls body(i) for every bit i that is set in bitmap, in order. */
+template <typename Body>
+void for_each_set_bit(const uint64_t *bitmap, size_t words, Body body)
+{
+    for (size_t w = 0; w < words; w++) {
+        uint64_t word = bitmap[w];
+        while (word != 0) {
+            body(64 * w + __builtin_ctzll(word));
+            // clears the lowest set bit.
+            word &= word - 1;
+        }
+    }
+}
@@ -1,62 +1,225 @@
 #include <cassert>
+#include <chrono>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
 
 #include "boost/asio.hpp"
 
 #include "networking.h"
+#include "set_file.h"
 
 using namespace std;
 using namespace boost::asio;
 
-int main()
+// how many queries' worth of encryptions of zero are kept in advance.
+const size_t ZERO_POOL_QUERIES = 4;
+
+int main(int argc, char **argv)
 {
-    vector<uint64_t> inputs = {0x02, 0x07, 0x05, 0xfe};
-    size_t input_bits = 32;
-    size_t poly_modulus_degree = 8192;
-    unsigned short port = 9999;
+    // the options come first.
+    string address = "localhost:9999";
+    string set_path;
+    size_t thread_count = 0;
+    optional<size_t> window_size;
+    while (argc >= 3) {
+        string option = argv[1];
+        if (option == "--connect") {
+            address = argv[2];
+        } else if (option == "--port") {
+            address = string("localhost:") + argv[2];
+        } else if (option == "--set") {
+            set_path = argv[2];
+        } else if (option == "--threads") {
+            thread_count = stoul(argv[2]);
+        } else if (option == "--window-size") {
+            window_size = stoul(argv[2]);
+        } else {
+            break;
+        }
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    if ((argc > 3) || ((argc >= 2) && (argv[1][0] == '-'))) {
+        cout << "USAGE: " << argv[0] << " [--connect address | --port port] [--set path]"
+             << " [--threads count] [--window-size size] [query_count] [key_directory]" << endl;
+        cout << "the address is host:port (localhost:9999 by default), or"
+             << " unix:path for a server on the same host, which is faster." << endl;
+        cout << "the set is read from a set file without labels (see"
+             << " set_file.h), whose items must fit into the server's input"
+             << " bits. without one, a small example set is used." << endl;
+        cout << "the queries are all sent over one connection, one after"
+             << " another, and the throughput is reported at the end." << endl;
+        cout << "if key_directory is given, the receiver's keys (and some"
+             << " precomputed encryptions) are kept there between runs." << endl;
+        return 1;
+    }
+    size_t query_count = (argc >= 2) ? atol(argv[1]) : 1;
 
     io_context context;
-    ip::tcp::socket socket(context);
-    ip::tcp::resolver resolver(context);
-    connect(socket, resolver.resolve("localhost", "9999", resolver.numeric_service));
-    Networking net(socket);
+    unique_ptr<Networking> connection = Networking::connect_to(context, address);
+    Networking &net = *connection;
 
-    cout << "connected, waiting for hello and set size" << endl;
+    // the sender's database is shared by all of its sessions, so the sender
+    // decides on everything the database depends on.
+    cout << "connected, waiting for hello and params" << endl;
     net.read_hello();
     size_t sender_size = net.read_uint32();
+    size_t receiver_size = net.read_uint32();
+    size_t partition_count = net.read_uint32();
+    size_t input_bits = net.read_uint32();
+    size_t poly_modulus_degree = net.read_uint32();
+    vector<uint64_t> seeds;
+    net.read_uint64s(seeds);
+    // an unlabeled set has no label columns.
+    vector<uint64_t> label_column_bits;
+    net.read_uint64s(label_column_bits);
+    bool labeled = !label_column_bits.empty();
 
-    cout << "picking params" << endl;
-    PSIParams params(inputs.size(), sender_size, input_bits, poly_modulus_degree);
-    params.generate_seeds();
+    vector<uint64_t> inputs = {0x02, 0x07, 0x05, 0xfe};
+    if (!set_path.empty()) {
+        cout << "loading " << set_path << endl;
+        try {
+            ThreadPool pool(thread_count);
+            vector<vector<uint64_t>> no_labels;
+            load_set(set_path, input_bits, {}, pool, inputs, no_labels);
+        } catch (exception &e) {
+            cout << e.what() << endl;
+            return 1;
+        }
+    }
+    if (inputs.size() > receiver_size) {
+        cout << "the server only takes sets of up to " << receiver_size << " items" << endl;
+        return 1;
+    }
+
+    PSIParams params(receiver_size, sender_size, input_bits, poly_modulus_degree);
+    params.set_sender_partition_count(partition_count);
+    params.set_seeds(seeds);
+    if (labeled) {
+        params.set_label_column_bits(vector<size_t>(label_column_bits.begin(), label_column_bits.end()));
+    }
+    if (window_size.has_value()) {
+        // the sender doesn't know our window size, so we send it the powers
+        // that we encrypt as a power basis.
+        params.set_window_size(window_size.value());
+        params.set_power_basis(params.windowing().source_powers());
+    }
     net.set_seal_context(params.context);
-    PSIReceiver receiver(params);
+    optional<KeyStore> key_store;
+    if (argc == 3) {
+        key_store.emplace(argv[2]);
+    }
+    PSIReceiver receiver(params, thread_count, key_store.has_value() ? &key_store.value() : nullptr);
+    if (key_store.has_value()) {
+        // the pool starts out with the zeros left over from the last run, and
+        // whatever is generated while we wait for the sender is saved for the
+        // next one.
+        receiver.enable_zero_pool(ZERO_POOL_QUERIES * params.windowing().ciphertext_count(),
+                                  key_store->path(params.context, "zeros"));
+    }
 
-    cout << "sending hello, set size, seeds, pk, relin keys" << endl;
+    cout << "sending hello, power basis, key fingerprints" << endl;
     net.write_hello();
-    net.write_uint32(inputs.size());
-    net.write_uint64s(params.seeds);
-    net.write_public_key(receiver.public_key());
-    net.write_relin_keys(receiver.relin_keys());
-
-    cout << "encrypting inputs" << endl;
-    vector<bucket_slot> buckets;
-    auto encrypted_inputs = receiver.encrypt_inputs(inputs, buckets);
+    net.write_uint64s(params.power_basis());
+    net.write_fingerprint(receiver.public_key_fingerprint());
+    if (params.needs_relin_keys()) {
+        // relin keys that are still being generated can't be in the sender's
+        // cache, so we don't wait for them and send a fingerprint that can't
+        // match anything instead.
+        if (receiver.relin_keys_ready()) {
+            net.write_fingerprint(receiver.relin_keys_fingerprint());
+        } else {
+            net.write_fingerprint(fingerprint_type());
+        }
+    }
+    uint32_t status = net.read_uint32();
+    if (status == NET_STATUS_BUSY) {
+        cout << "the server is too busy, try again later" << endl;
+        return 1;
+    } else if (status != NET_STATUS_OK) {
+        assert(status == NET_STATUS_TOO_EXPENSIVE);
+        cout << "the query is too expensive for the server, try a smaller set" << endl;
+        return 1;
+    }
+    uint32_t missing_keys = net.read_uint32();
 
-    cout << "sending inputs" << endl;
-    net.write_ciphertexts(encrypted_inputs);
+    if (missing_keys & NET_SEND_PUBLIC_KEY) {
+        cout << "sending pk" << endl;
+        net.write_public_key(receiver.public_key());
+    }
 
-    cout << "waiting for encrypted matches" << endl;
+    auto start = std::chrono::steady_clock::now();
     vector<Ciphertext> encrypted_matches;
-    net.read_ciphertexts(encrypted_matches);
+    for (size_t query = 0; query < query_count; query++) {
+        // the inputs are encrypted in parallel, and each one is sent as soon
+        // as it's ready. meanwhile, the relin keys are being generated in the
+        // background, so we send them after the first query.
+        vector<bucket_slot> buckets;
+        net.write_frame_header(NET_FRAME_QUERY, query);
+        net.write_ciphertexts_start(params.windowing().ciphertext_count());
+        receiver.encrypt_inputs(inputs, buckets, [&](size_t, Ciphertext &window) {
+            net.write_ciphertext(window);
+            net.flush();
+        });
 
-    cout << "decrypting matches" << endl;
-    auto matches = receiver.decrypt_labeled_matches(encrypted_matches);
+        if ((query == 0) && (missing_keys & NET_SEND_RELIN_KEYS)) {
+            cout << "sending relin keys" << endl;
+            net.write_relin_keys(receiver.relin_keys());
+        }
 
-    cout << matches.size() << " matches found: ";
-    for (auto i : matches) {
-        assert(i.first < buckets.size());
-        assert(buckets[i.first] != BUCKET_EMPTY);
-        cout << inputs[buckets[i.first].first] << "-" << i.second << " ";
+        uint32_t request_id;
+        uint32_t frame = net.read_frame_header(request_id);
+        if ((frame != NET_FRAME_RESPONSE) || (request_id != query)) {
+            throw runtime_error("the sender didn't respond to the query");
+        }
+        // the sender sends every partition's result as soon as it's ready,
+        // so we decrypt each one as soon as it arrives.
+        // for a labeled set, every partition's result is followed by one for
+        // every chunk of the labels.
+        size_t results_per_partition = labeled ? (1 + params.label_chunks().size()) : 1;
+        size_t response_count = net.read_ciphertexts_start();
+        if (response_count != results_per_partition * params.sender_partition_count()) {
+            throw runtime_error("the sender sent " + to_string(response_count) + " results, expected "
+                                + to_string(results_per_partition * params.sender_partition_count()));
+        }
+        encrypted_matches.resize(results_per_partition);
+        vector<pair<size_t, vector<uint64_t>>> matches;
+        for (size_t i = 0; i < response_count / results_per_partition; i++) {
+            for (auto &encrypted : encrypted_matches) {
+                net.read_ciphertext(encrypted);
+            }
+            if (labeled) {
+                receiver.decrypt_partition_label_columns(encrypted_matches[0], &encrypted_matches[1], matches);
+            } else {
+                vector<size_t> match_buckets;
+                receiver.decrypt_partition_matches(encrypted_matches[0], match_buckets);
+                for (size_t bucket : match_buckets) {
+                    matches.emplace_back(bucket, vector<uint64_t>());
+                }
+            }
+        }
+
+        if (query == 0) {
+            cout << matches.size() << " matches found: ";
+            for (auto i : matches) {
+                assert(i.first < buckets.size());
+                assert(buckets[i.first] != BUCKET_EMPTY);
+                cout << inputs[buckets[i.first].first];
+                for (uint64_t label : i.second) {
+                    cout << "-" << hex << label << dec;
+                }
+                cout << " ";
+            }
+            cout << endl;
+        }
     }
-    cout << endl;
+    net.write_frame_header(NET_FRAME_END, query_count);
+    net.flush();
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    cout << query_count << " queries in " << duration.count() << " s ("
+         << query_count / duration.count() << " queries/s)" << endl;
 }
@@ -0,0 +1,218 @@
+#include <cassert>
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "coefficient_file.h"
+
+// pread and pwrite may transfer fewer bytes than they were asked to.
+void pread_all(int file, void *destination, size_t byte_count, uint64_t offset)
+{
+    uint8_t *bytes = static_cast<uint8_t *>(destination);
+    while (byte_count > 0) {
+        ssize_t count = pread(file, bytes, byte_count, offset);
+        if ((count < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (count <= 0) {
+            throw system_error(count < 0 ? errno : EIO, generic_category(), "reading coefficients");
+        }
+        bytes += count;
+        byte_count -= count;
+        offset += count;
+    }
+}
+
+void pwrite_all(int file, const void *source, size_t byte_count, uint64_t offset)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(source);
+    while (byte_count > 0) {
+        ssize_t count = pwrite(file, bytes, byte_count, offset);
+        if ((count < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (count < 0) {
+            throw system_error(errno, generic_category(), "writing coefficients");
+        }
+        bytes += count;
+        byte_count -= count;
+        offset += count;
+    }
+}
+
+CoefficientFile::CoefficientFile(const string &path,
+                                 size_t slot_count,
+                                 size_t chunk_count,
+                                 vector<size_t> coefficient_counts)
+    : slot_count(slot_count), chunk_count(chunk_count), coefficient_counts(coefficient_counts)
+{
+    file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (file < 0) {
+        throw system_error(errno, generic_category(), "creating " + path);
+    }
+    unlink(path.c_str());
+
+    // every partition has one polynomial f, and one polynomial g per chunk.
+    uint64_t offset = 0;
+    for (size_t count : coefficient_counts) {
+        offsets.push_back(offset);
+        offset += (1 + chunk_count) * count * slot_count * sizeof(uint64_t);
+    }
+
+    // the partitions are read in order, so the kernel can read ahead.
+    posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+CoefficientFile::~CoefficientFile()
+{
+    close(file);
+}
+
+size_t CoefficientFile::partition_count() const
+{
+    return coefficient_counts.size();
+}
+
+void CoefficientFile::write_partition(size_t partition, const PartitionCoefficients &coefficients) const
+{
+    size_t count = coefficient_counts[partition];
+    assert((coefficients.f_coeffs.size() == count) && (coefficients.g_coeffs.size() == chunk_count));
+
+    size_t plaintext_bytes = slot_count * sizeof(uint64_t);
+    uint64_t offset = offsets[partition];
+    auto write_plaintexts = [&](const vector<Plaintext> &plaintexts) {
+        assert(plaintexts.size() == count);
+        for (const Plaintext &plaintext : plaintexts) {
+            assert(plaintext.coeff_count() == slot_count);
+            pwrite_all(file, plaintext.data(), plaintext_bytes, offset);
+            offset += plaintext_bytes;
+        }
+    };
+    write_plaintexts(coefficients.f_coeffs);
+    for (auto &chunk_coeffs : coefficients.g_coeffs) {
+        write_plaintexts(chunk_coeffs);
+    }
+}
+
+void CoefficientFile::read_partition(size_t partition, PartitionCoefficients &coefficients) const
+{
+    size_t count = coefficient_counts[partition];
+    coefficients.f_coeffs.resize(count);
+    coefficients.g_coeffs.resize(chunk_count);
+
+    size_t plaintext_bytes = slot_count * sizeof(uint64_t);
+    uint64_t offset = offsets[partition];
+    auto read_plaintexts = [&](vector<Plaintext> &plaintexts) {
+        plaintexts.resize(count);
+        for (Plaintext &plaintext : plaintexts) {
+            plaintext.resize(slot_count);
+            pread_all(file, plaintext.data(), plaintext_bytes, offset);
+            offset += plaintext_bytes;
+        }
+    };
+    read_plaintexts(coefficients.f_coeffs);
+    for (auto &chunk_coeffs : coefficients.g_coeffs) {
+        read_plaintexts(chunk_coeffs);
+    }
+}
+
+void CoefficientFile::write_slots(size_t partition,
+                                  size_t polynomial,
+                                  size_t j,
+                                  size_t first_slot,
+                                  const uint64_t *values,
+                                  size_t count) const
+{
+    size_t coefficient_count = coefficient_counts[partition];
+    assert((polynomial <= chunk_count) && (j < coefficient_count) && (first_slot + count <= slot_count));
+
+    uint64_t plaintext = polynomial * coefficient_count + j;
+    uint64_t offset = offsets[partition] + (plaintext * slot_count + first_slot) * sizeof(uint64_t);
+    pwrite_all(file, values, count * sizeof(uint64_t), offset);
+}
+
+PartitionLoader::PartitionLoader(const CoefficientFile &file, size_t buffer_count)
+    : file(file),
+      buffers(buffer_count),
+      loaded(0),
+      released(file.partition_count(), false),
+      stopping(false),
+      loader(&PartitionLoader::load_partitions, this)
+{
+    assert(buffer_count > 0);
+}
+
+PartitionLoader::~PartitionLoader()
+{
+    {
+        lock_guard<mutex> lock(state_mutex);
+        stopping = true;
+    }
+    state_changed.notify_all();
+    loader.join();
+}
+
+void PartitionLoader::load_partitions()
+{
+    size_t buffer_count = buffers.size();
+    for (size_t partition = 0; partition < file.partition_count(); partition++) {
+        // the buffer is free once the partition that used it before is.
+        {
+            unique_lock<mutex> lock(state_mutex);
+            state_changed.wait(lock, [&] {
+                return stopping || (partition < buffer_count) || released[partition - buffer_count];
+            });
+            if (stopping) {
+                return;
+            }
+        }
+
+        try {
+            file.read_partition(partition, buffers[partition % buffer_count]);
+        } catch (...) {
+            lock_guard<mutex> lock(state_mutex);
+            error = current_exception();
+            state_changed.notify_all();
+            return;
+        }
+
+        lock_guard<mutex> lock(state_mutex);
+        loaded = partition + 1;
+        state_changed.notify_all();
+    }
+}
+
+const PartitionCoefficients &PartitionLoader::acquire(size_t partition)
+{
+    unique_lock<mutex> lock(state_mutex);
+    state_changed.wait(lock, [&] { return error || (loaded > partition); });
+    if (loaded <= partition) {
+        rethrow_exception(error);
+    }
+    return buffers[partition % buffers.size()];
+}
+
+void PartitionLoader::release(size_t partition)
+{
+    {
+        lock_guard<mutex> lock(state_mutex);
+        released[partition] = true;
+    }
+    state_changed.notify_all();
+}
+
+LoadedPartition::LoadedPartition(PartitionLoader &loader, size_t partition)
+    : loader(loader), partition(partition), coefficients_(&loader.acquire(partition))
+{}
+
+LoadedPartition::~LoadedPartition()
+{
+    loader.release(partition);
+}
+
+const PartitionCoefficients &LoadedPartition::coefficients()
+{
+    return *coefficients_;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "seal/seal.h"
+
+using namespace std;
+using namespace seal;
+
+/*
+For a large enough set, the sender's precomputed coefficients don't fit into
+memory, but every query only needs one partition's coefficients at a time. So
+they can be kept in a CoefficientFile on disk instead, from which a
+PartitionLoader reads the partitions of every query in order, on a thread of
+its own, while the partitions before them are being evaluated. Then only the
+powers and a couple of partitions per thread are in memory at any time, and if
+the disk is fast enough to keep up with the evaluation, reading the
+coefficients costs nothing but the bandwidth.
+*/
+
+/* the coefficients of one partition's polynomials. f_coeffs[j] contains the jth
+   coefficients of the polynomials f of every bucket, batched into one
+   plaintext, and g_coeffs[c][j] likewise for the polynomials g of label chunk
+   c (if the set is labeled). */
+struct PartitionCoefficients
+{
+    vector<Plaintext> f_coeffs;
+    vector<vector<Plaintext>> g_coeffs;
+};
+
+class CoefficientFile
+{
+public:
+    /* creates a file at path for partitions with coefficient_counts[p]
+       coefficients in each of their polynomials, every one of which is a
+       plaintext of slot_count coefficients. the file is removed right away, so
+       it only lasts as long as the CoefficientFile. */
+    CoefficientFile(const string &path,
+                    size_t slot_count,
+                    size_t chunk_count,
+                    vector<size_t> coefficient_counts);
+    ~CoefficientFile();
+
+    CoefficientFile(const CoefficientFile &) = delete;
+    CoefficientFile &operator=(const CoefficientFile &) = delete;
+
+    size_t partition_count() const;
+
+    /* both are safe to call from multiple threads, for different partitions. */
+    void write_partition(size_t partition, const PartitionCoefficients &coefficients) const;
+    /* reuses the plaintexts that coefficients already has. */
+    void read_partition(size_t partition, PartitionCoefficients &coefficients) const;
+    /* writes values to count consecutive slots of the jth coefficient of one
+       of a partition's polynomials, starting with first_slot. polynomial 0 is
+       f, and polynomial 1 + c is chunk c's g. */
+    void write_slots(size_t partition,
+                     size_t polynomial,
+                     size_t j,
+                     size_t first_slot,
+                     const uint64_t *values,
+                     size_t count) const;
+
+private:
+    int file;
+    size_t slot_count;
+    size_t chunk_count;
+    vector<size_t> coefficient_counts;
+    // where every partition starts in the file.
+    vector<uint64_t> offsets;
+};
+
+class PartitionLoader
+{
+public:
+    /* starts loading the file's partitions in order, keeping at most
+       buffer_count of them in memory at once: the next partition is only read
+       once the partition buffer_count before it has been released. */
+    PartitionLoader(const CoefficientFile &file, size_t buffer_count);
+    /* stops loading, and waits for the partition that is being read. */
+    ~PartitionLoader();
+
+    /* waits until the partition has been loaded, and rethrows the error if it
+       couldn't be. every partition must be released after it has been
+       acquired, which LoadedPartition takes care of. */
+    const PartitionCoefficients &acquire(size_t partition);
+    void release(size_t partition);
+
+private:
+    void load_partitions();
+
+    const CoefficientFile &file;
+    vector<PartitionCoefficients> buffers;
+    // the number of partitions that have been loaded.
+    size_t loaded;
+    vector<bool> released;
+    bool stopping;
+    exception_ptr error;
+    mutex state_mutex;
+    condition_variable state_changed;
+    // NB: this must be declared last, so that everything it uses exists
+    // before it's started.
+    thread loader;
+};
+
+/* a partition that is acquired from a PartitionLoader for as long as the
+   LoadedPartition exists. */
+class LoadedPartition
+{
+public:
+    LoadedPartition(PartitionLoader &loader, size_t partition);
+    ~LoadedPartition();
+
+    LoadedPartition(const LoadedPartition &) = delete;
+    LoadedPartition &operator=(const LoadedPartition &) = delete;
+
+    const PartitionCoefficients &coefficients();
+
+private:
+    PartitionLoader &loader;
+    size_t partition;
+    const PartitionCoefficients *coefficients_;
+};
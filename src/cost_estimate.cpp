@@ -0,0 +1,98 @@
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cost_model.h"
+#include "powers_dag.h"
+#include "psi.h"
+
+using namespace std;
+
+void print_row(string name, QueryCost &cost, double latency, bool best)
+{
+    cout << (best ? "* " : "  ")
+         << left << setw(18) << name << right
+         << setw(12) << fixed << setprecision(2) << cost.upload_bytes / 1e6
+         << setw(12) << cost.download_bytes / 1e6
+         << setw(8) << cost.receiver_encryptions
+         << setw(8) << cost.sender_multiplications
+         << setw(7) << cost.sender_multiplication_depth
+         << setw(12) << setprecision(3) << latency
+         << endl;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc != 8) && (argc != 9)) {
+        cout << "USAGE:" << endl;
+        cout << argv[0] << " labeled" // argv[1]
+                        << " inputs_bits" // argv[2]
+                        << " sender_size" // argv[3]
+                        << " receiver_size" // argv[4]
+                        << " poly_modulus_degree" // argv[5]
+                        << " partition_count" // argv[6]
+                        << " bandwidth_mbit" // argv[7]
+                        << " [sender_threads]" // argv[8]
+                        << endl;
+        cout << "compares the estimated cost of one query with every windowing "
+             << "and power basis setting, including the mode without "
+             << "relinearization keys (power basis depth 0)." << endl;
+        return 1;
+    }
+
+    bool labeled = (atol(argv[1]) != 0);
+    size_t input_bits = atol(argv[2]);
+    size_t sender_size = atol(argv[3]);
+    size_t receiver_size = atol(argv[4]);
+    size_t poly_modulus_degree = atol(argv[5]);
+    size_t partition_count = atol(argv[6]);
+    double bandwidth = atof(argv[7]) * 1e6 / 8;
+    size_t sender_threads = (argc == 9) ? atol(argv[8]) : 1;
+
+    PSIParams params(receiver_size, sender_size, input_bits, poly_modulus_degree);
+    params.set_sender_partition_count(partition_count);
+
+    cout << "measuring operation timings..." << endl;
+    OperationTimings timings = measure_operation_timings(params, bandwidth);
+    cout << "  encryption " << timings.encryption
+         << " s, multiplication + relinearization " << timings.multiplication
+         << " s, plain multiplication " << timings.plain_multiplication
+         << " s, relin key generation " << timings.relin_keys_generation
+         << " s" << endl << endl;
+
+    vector<pair<string, QueryCost>> costs;
+    for (size_t window_size = 0; window_size <= 4; window_size++) {
+        params.set_window_size(window_size);
+        params.set_power_basis({});
+        costs.emplace_back("window " + to_string(window_size), QueryCost(params, labeled));
+    }
+    for (size_t depth = 0; depth <= 4; depth++) {
+        params.set_power_basis(plan_power_basis(params.max_partition_size(), depth));
+        string name = (depth == 0) ? "no relin keys" : ("basis depth " + to_string(depth));
+        costs.emplace_back(name, QueryCost(params, labeled));
+    }
+
+    size_t best = 0;
+    vector<double> latencies;
+    for (size_t i = 0; i < costs.size(); i++) {
+        latencies.push_back(costs[i].second.latency(timings, sender_threads));
+        if (latencies[i] < latencies[best]) {
+            best = i;
+        }
+    }
+
+    cout << "  " << left << setw(18) << "mode" << right
+         << setw(12) << "upload MB"
+         << setw(12) << "download MB"
+         << setw(8) << "encs"
+         << setw(8) << "mults"
+         << setw(7) << "depth"
+         << setw(12) << "latency, s"
+         << endl;
+    for (size_t i = 0; i < costs.size(); i++) {
+        print_row(costs[i].first, costs[i].second, latencies[i], i == best);
+    }
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <chrono>
+
+#include "bit_packing.h"
+#include "random.h"
+
+#include "cost_model.h"
+
+// how many times each operation is repeated when measuring it.
+const size_t COST_MODEL_REPETITIONS = 5;
+
+template <typename F>
+double time_operation(size_t repetitions, F operation)
+{
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < repetitions; i++) {
+        operation();
+    }
+    chrono::duration<double> duration = chrono::steady_clock::now() - start;
+    return duration.count() / repetitions;
+}
+
+OperationTimings measure_operation_timings(PSIParams &params, double bandwidth)
+{
+    OperationTimings timings;
+    timings.bandwidth = bandwidth;
+
+    KeyGenerator keygen(params.context);
+    Encryptor encryptor(params.context, keygen.public_key());
+    Decryptor decryptor(params.context, keygen.secret_key());
+    Evaluator evaluator(params.context);
+    BatchEncoder encoder(params.context);
+
+    auto random_factory = UniformRandomGeneratorFactory::default_factory();
+    auto random = random_factory->create();
+    vector<uint64_t> values(encoder.slot_count());
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = random_nonzero_integer(random, params.plain_modulus());
+    }
+    Plaintext plain;
+    encoder.encode(values, plain);
+
+    RelinKeys relin_keys;
+    timings.relin_keys_generation = time_operation(1, [&] {
+        relin_keys = keygen.relin_keys(RELIN_KEYS_DECOMPOSITION_BIT_COUNT);
+    });
+
+    Ciphertext encrypted, product;
+    timings.encryption = time_operation(COST_MODEL_REPETITIONS, [&] {
+        encryptor.encrypt(plain, encrypted);
+    });
+    timings.multiplication = time_operation(COST_MODEL_REPETITIONS, [&] {
+        evaluator.multiply(encrypted, encrypted, product);
+        evaluator.relinearize_inplace(product, relin_keys);
+    });
+    timings.plain_multiplication = time_operation(COST_MODEL_REPETITIONS, [&] {
+        evaluator.multiply_plain(encrypted, plain, product);
+    });
+    timings.decryption = time_operation(COST_MODEL_REPETITIONS, [&] {
+        decryptor.decrypt(encrypted, plain);
+    });
+
+    return timings;
+}
+
+QueryCost::QueryCost(PSIParams &params, bool labeled)
+{
+    auto &parms = params.context->first_context_data()->parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    auto &coeff_modulus = parms.coeff_modulus();
+
+    // keys are sent in SEAL's format, with 64 bits per coefficient, but
+    // ciphertexts are bit-packed to the width of each prime.
+    size_t unpacked_ciphertext_bytes = 2 * poly_modulus_degree * coeff_modulus.size() * sizeof(uint64_t);
+    ciphertext_bytes = packed_ciphertext_size(params.context, params.context->first_parms_id(), 2);
+    public_key_bytes = unpacked_ciphertext_bytes;
+    relin_keys_bytes = 0;
+    for (auto &prime : coeff_modulus) {
+        size_t components = (prime.bit_count() + RELIN_KEYS_DECOMPOSITION_BIT_COUNT - 1)
+                            / RELIN_KEYS_DECOMPOSITION_BIT_COUNT;
+        relin_keys_bytes += components * unpacked_ciphertext_bytes;
+    }
+
+    Windowing windowing = params.windowing();
+    needs_relin_keys = params.needs_relin_keys();
+    query_ciphertexts = windowing.ciphertext_count();
+    size_t partition_count = params.sender_partition_count();
+    // labels are returned in chunks, see PSIParams::label_chunks.
+    size_t results_per_partition = 1 + (labeled ? params.label_chunks().size() : 0);
+    response_ciphertexts = results_per_partition * partition_count;
+
+    upload_bytes = public_key_bytes
+                   + (needs_relin_keys ? relin_keys_bytes : 0)
+                   + query_ciphertexts * ciphertext_bytes;
+    download_bytes = response_ciphertexts * ciphertext_bytes;
+
+    receiver_encryptions = query_ciphertexts;
+    receiver_decryptions = response_ciphertexts;
+    sender_multiplications = windowing.dag().multiplication_count();
+    sender_multiplication_depth = windowing.dag().depth();
+    // every row of the hash table contributes one nonzero power of x to f(x)
+    // (and at most one to every chunk's g(x)), and then every result is masked.
+    size_t capacity = params.sender_bucket_capacity();
+    sender_plain_multiplications = results_per_partition * (capacity + partition_count);
+    // in memory, ciphertexts are not packed.
+    sender_powers_bytes = (params.max_partition_size() + 1) * unpacked_ciphertext_bytes;
+}
+
+double QueryCost::latency(OperationTimings &timings, size_t sender_threads)
+{
+    double receiver_time = receiver_encryptions * timings.encryption
+                           + receiver_decryptions * timings.decryption;
+    if (needs_relin_keys) {
+        receiver_time += timings.relin_keys_generation;
+    }
+
+    double network_time = (upload_bytes + download_bytes) / timings.bandwidth;
+
+    return receiver_time + sender_time(timings, sender_threads) + network_time;
+}
+
+double QueryCost::sender_time(OperationTimings &timings, size_t sender_threads)
+{
+    // the powers are computed in parallel, but no faster than the longest
+    // chain of multiplications allows. the partitions are evaluated in
+    // parallel too.
+    size_t threads = max<size_t>(sender_threads, 1);
+    double parallel_multiplications = max(
+        (double) sender_multiplications / threads,
+        (double) sender_multiplication_depth
+    );
+    return parallel_multiplications * timings.multiplication
+           + (double) sender_plain_multiplications / threads * timings.plain_multiplication;
+}
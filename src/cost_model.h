@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+#include "psi.h"
+
+/*
+The cost model estimates what a single query costs, in bytes sent over the
+network and in homomorphic operations done by either party, and turns that into
+an estimate of the end-to-end latency given the speed of the link and of the
+individual operations.
+
+Sizes are computed from the encryption parameters: a ciphertext of size 2
+consists of 2 * N * (number of primes in the coefficient modulus) 64-bit
+coefficients, a public key has the same size, and relinearization keys with
+decomposition bit count b contain ceil(log2(q) / b) such ciphertexts for every
+prime q in the coefficient modulus.
+*/
+
+struct OperationTimings
+{
+    // all of these are in seconds.
+    double encryption;
+    double decryption;
+    // a ciphertext-ciphertext multiplication followed by relinearization.
+    double multiplication;
+    double plain_multiplication;
+    double relin_keys_generation;
+    // link speed in bytes per second.
+    double bandwidth;
+};
+
+/* measures how long each operation takes on this machine with the given
+   parameters. takes a few seconds. */
+OperationTimings measure_operation_timings(PSIParams &params, double bandwidth);
+
+class QueryCost
+{
+public:
+    QueryCost(PSIParams &params, bool labeled);
+
+    /* estimated time from the receiver starting to prepare its query to it
+       having decrypted the response, in seconds. */
+    double latency(OperationTimings &timings, size_t sender_threads);
+    /* the part of the latency that the sender spends computing, in seconds. */
+    double sender_time(OperationTimings &timings, size_t sender_threads);
+
+    bool needs_relin_keys;
+    size_t ciphertext_bytes;
+    size_t public_key_bytes;
+    size_t relin_keys_bytes;
+    size_t query_ciphertexts;
+    size_t response_ciphertexts;
+    size_t upload_bytes;
+    size_t download_bytes;
+
+    size_t receiver_encryptions;
+    size_t receiver_decryptions;
+    size_t sender_multiplications;
+    size_t sender_multiplication_depth;
+    size_t sender_plain_multiplications;
+    // the memory the sender needs for the powers of the receiver's input.
+    size_t sender_powers_bytes;
+};
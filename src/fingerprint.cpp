@@ -0,0 +1,18 @@
+#include <cstring>
+#include <vector>
+
+#include "fingerprint.h"
+
+fingerprint_type fingerprint_bytes(const string &bytes)
+{
+    // the hash function works on 64-bit words, so we pad the input with zeros
+    // and append its length to make the padding unambiguous.
+    size_t word_count = (bytes.size() + 7) / 8;
+    vector<uint64_t> words(word_count + 1, 0);
+    memcpy(words.data(), bytes.data(), bytes.size());
+    words[word_count] = bytes.size();
+
+    fingerprint_type result;
+    util::HashFunction::sha3_hash(words.data(), words.size(), result);
+    return result;
+}
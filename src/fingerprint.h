@@ -0,0 +1,24 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+
+#include "seal/seal.h"
+#include "seal/util/hash.h"
+
+using namespace std;
+using namespace seal;
+
+typedef util::HashFunction::sha3_block_type fingerprint_type;
+
+/* SHA-3 hash of a string of bytes. */
+fingerprint_type fingerprint_bytes(const string &bytes);
+
+/* SHA-3 hash of the serialization of a SEAL object, such as a key. */
+template <typename T>
+fingerprint_type fingerprint(const T &object)
+{
+    stringstream stream;
+    object.save(stream);
+    return fingerprint_bytes(stream.str());
+}
@@ -1,4 +1,11 @@
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <memory>
+#include <system_error>
+
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "aes.h"
 
@@ -16,6 +23,65 @@ size_t loc_aes_hash(AES &aes, size_t m, uint64_t value) {
 	return aes_hash(aes, m, value >> m) ^ (value & ((1ull << m) - 1));
 }
 
+// the number of inputs that are hashed at a time.
+const size_t HASH_BATCH_SIZE = 4096;
+
+// loc_aes_hash for count inputs, with the AES blocks encrypted in batches.
+void loc_aes_hash_batch(AES &aes, size_t m, const uint64_t *inputs, size_t count, uint64_t *locations) {
+	assert(m < 64);
+	uint64_t mask = (1ull << m) - 1;
+	for (size_t i = 0; i < count; i++) {
+		locations[i] = inputs[i] >> m;
+	}
+	aes.encrypt_low(0, locations, count, locations);
+	for (size_t i = 0; i < count; i++) {
+		locations[i] = ((locations[i] ^ (inputs[i] >> m)) & mask) ^ (inputs[i] & mask);
+	}
+}
+
+// calls place(input_index, seed_index, location) for every input hashed with
+// every function, in the order complete_hash places them, until place returns
+// false.
+template <typename Place>
+bool hash_every_function(vector<uint64_t> &inputs, size_t m, vector<uint64_t> &seeds, Place place) {
+	vector<AES> aes(seeds.size());
+	for (size_t i = 0; i < seeds.size(); i++) {
+		aes[i].set_key(0, seeds[i]);
+	}
+
+	vector<vector<uint64_t>> locations(seeds.size(), vector<uint64_t>(HASH_BATCH_SIZE));
+	for (size_t start = 0; start < inputs.size(); start += HASH_BATCH_SIZE) {
+		size_t count = min(HASH_BATCH_SIZE, inputs.size() - start);
+		for (size_t j = 0; j < seeds.size(); j++) {
+			loc_aes_hash_batch(aes[j], m, &inputs[start], count, locations[j].data());
+		}
+		for (size_t i = 0; i < count; i++) {
+			for (size_t j = 0; j < seeds.size(); j++) {
+				if (!place(start + i, j, locations[j][i])) {
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// shuffles each of the bucket_count buckets of a table, to avoid leaking
+// information about bucket load distribution through partitioning.
+void shuffle_buckets(shared_ptr<UniformRandomGenerator> random,
+                     vector<bucket_slot> &buckets,
+                     size_t bucket_count,
+                     size_t capacity) {
+	for (size_t bucket = 0; bucket < bucket_count; bucket++) {
+		for (size_t slot = 1; slot < capacity; slot++) {
+			// uniformly pick a random slot before this one (possibly this
+			// very same one) and swap
+			size_t prev_slot = random_integer(random, slot + 1);
+			buckets[capacity * bucket + slot].swap(buckets[capacity * bucket + prev_slot]);
+		}
+	}
+}
+
 bool cuckoo_hash(shared_ptr<UniformRandomGenerator> random,
 	             vector<uint64_t> &inputs,
 	             size_t m,
@@ -75,39 +141,245 @@ bool complete_hash(shared_ptr<UniformRandomGenerator> random,
 		buckets[i] = BUCKET_EMPTY;
 	}
 
-	vector<AES> aes(seeds.size());
-	for (size_t i = 0; i < seeds.size(); i++) {
-		aes[i].set_key(0, seeds[i]);
-	}
-
 	vector<size_t> capacity_used(1 << m);
 
 	// insert all elements into the table in a deterministic order (filling each
 	// bucket sequentially)
-	for (size_t i = 0; i < inputs.size(); i++) {
-		for (size_t j = 0; j < seeds.size(); j++) {
-			size_t loc = loc_aes_hash(aes[j], m, inputs[i]);
+	bool fits = hash_every_function(inputs, m, seeds, [&](size_t i, size_t j, size_t loc) {
+		if (capacity_used[loc] == capacity) {
+			// all slots in the bucket are used, so we cannot add this
+			// element
+			return false;
+		}
+
+		buckets[capacity * loc + capacity_used[loc]] = make_pair(i, j);
+		capacity_used[loc]++;
+		return true;
+	});
+	if (!fits) {
+		return false;
+	}
+
+	// now shuffle each bucket
+	shuffle_buckets(random, buckets, 1 << m, capacity);
+
+	return true;
+}
+
+// an element of the table on its way through a temporary file.
+struct HashRecord
+{
+	uint64_t input_index;
+	uint32_t bucket;
+	uint32_t seed_index;
+};
+
+// the most temporary files that are written at once. if there are more slices,
+// they're split up in several passes.
+const size_t MAX_OPEN_RUNS = 64;
 
-			if (capacity_used[loc] == capacity) {
-				// all slots in the bucket are used, so we cannot add this
-				// element
-				return false;
+// a temporary file of records, which are read back in the order they were
+// appended. the file is removed as soon as it's created, so it disappears when
+// it's closed, even if we crash.
+class RecordRun
+{
+public:
+	RecordRun(const string &temp_directory, size_t buffer_records)
+		: buffer(buffer_records), buffered(0)
+	{
+		string path = temp_directory + "/pc_table_XXXXXX";
+		file = mkstemp(&path[0]);
+		if (file < 0) {
+			throw system_error(errno, generic_category(), "creating " + path);
+		}
+		unlink(path.c_str());
+	}
+
+	RecordRun(const RecordRun &) = delete;
+	RecordRun &operator=(const RecordRun &) = delete;
+
+	~RecordRun() {
+		close(file);
+	}
+
+	void append(const HashRecord &record) {
+		buffer[buffered++] = record;
+		if (buffered == buffer.size()) {
+			flush();
+		}
+	}
+
+	// writes what's left in the buffer, and frees it.
+	void finish_writing() {
+		flush();
+		vector<HashRecord>().swap(buffer);
+	}
+
+	// calls visit with every record, reading records.size() at a time.
+	template <typename Visit>
+	void read(vector<HashRecord> &records, Visit visit) {
+		if (lseek(file, 0, SEEK_SET) != 0) {
+			throw system_error(errno, generic_category(), "reading table");
+		}
+		size_t record_count;
+		while ((record_count = read_fully(records.data(), records.size() * sizeof(HashRecord)) / sizeof(HashRecord)) > 0) {
+			for (size_t k = 0; k < record_count; k++) {
+				visit(records[k]);
 			}
+		}
+	}
 
-			buckets[capacity * loc + capacity_used[loc]] = make_pair(i, j);
-			capacity_used[loc]++;
+private:
+	void flush() {
+		const char *data = reinterpret_cast<const char *>(buffer.data());
+		size_t size = buffered * sizeof(HashRecord);
+		while (size > 0) {
+			ssize_t written = write(file, data, size);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				throw system_error(errno, generic_category(), "writing table");
+			}
+			data += written;
+			size -= written;
 		}
+		buffered = 0;
 	}
 
-	// now shuffle each bucket, to avoid leaking information about bucket load
-	// distribution through partitioning
-	for (size_t bucket = 0; bucket < (1 << m); bucket++) {
-		for (size_t slot = 1; slot < capacity; slot++) {
-			// uniformly pick a random slot before this one (possibly this
-			// very same one) and swap
-			size_t prev_slot = random_integer(random, slot + 1);
-			buckets[capacity * bucket + slot].swap(buckets[capacity * bucket + prev_slot]);
+	// only reads less than size bytes at the end of the file.
+	size_t read_fully(void *destination, size_t size) {
+		char *data = static_cast<char *>(destination);
+		size_t done = 0;
+		while (done < size) {
+			ssize_t count = ::read(file, data + done, size - done);
+			if (count < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				throw system_error(errno, generic_category(), "reading table");
+			}
+			if (count == 0) {
+				break;
+			}
+			done += count;
+		}
+		return done;
+	}
+
+	int file;
+	vector<HashRecord> buffer;
+	size_t buffered;
+};
+
+// consecutive slices whose records are in one run.
+struct SliceGroup
+{
+	size_t first_slice;
+	size_t slice_count;
+	unique_ptr<RecordRun> run;
+};
+
+bool complete_hash_slices(shared_ptr<UniformRandomGenerator> random,
+                          vector<uint64_t> &inputs,
+                          size_t m,
+                          size_t capacity,
+                          vector<uint64_t> &seeds,
+                          size_t memory_budget,
+                          const string &temp_directory,
+                          function<void(size_t first_bucket, size_t bucket_count, vector<bucket_slot> &slice)> on_slice)
+{
+	// half of the budget goes to the slice, and the other half to the buffers
+	// of the temporary files, of which at most MAX_OPEN_RUNS are written while
+	// one more is read.
+	size_t bucket_count = (1 << m);
+	size_t slice_buckets = max<size_t>(1, memory_budget / 2 / (capacity * sizeof(bucket_slot)));
+	if (slice_buckets >= bucket_count) {
+		vector<bucket_slot> buckets;
+		if (!complete_hash(random, inputs, m, capacity, buckets, seeds)) {
+			return false;
+		}
+		on_slice(0, bucket_count, buckets);
+		return true;
+	}
+	size_t slice_count = (bucket_count + slice_buckets - 1) / slice_buckets;
+	size_t buffer_records = max<size_t>(1, memory_budget / 2 / (MAX_OPEN_RUNS + 1) / sizeof(HashRecord));
+
+	// splits the slices into at most MAX_OPEN_RUNS groups, each with a run of
+	// its own. every group but the last has the same number of slices, so
+	// group_of can find the group of a bucket from the first one.
+	auto split = [&](size_t first_slice, size_t count) {
+		size_t group_slices = (count + MAX_OPEN_RUNS - 1) / MAX_OPEN_RUNS;
+		vector<SliceGroup> groups;
+		for (size_t first = first_slice; first < first_slice + count; first += group_slices) {
+			size_t group_count = min(group_slices, first_slice + count - first);
+			groups.push_back({first, group_count, make_unique<RecordRun>(temp_directory, buffer_records)});
 		}
+		return groups;
+	};
+	auto group_of = [&](vector<SliceGroup> &groups, size_t bucket) -> RecordRun & {
+		return *groups[(bucket / slice_buckets - groups[0].first_slice) / groups[0].slice_count].run;
+	};
+
+	// first, the elements are appended to the runs of their slices' groups,
+	// in the order complete_hash inserts them.
+	vector<size_t> capacity_used(bucket_count);
+	vector<SliceGroup> groups = split(0, slice_count);
+	bool fits = hash_every_function(inputs, m, seeds, [&](size_t i, size_t j, size_t loc) {
+		if (capacity_used[loc] == capacity) {
+			return false;
+		}
+		capacity_used[loc]++;
+
+		group_of(groups, loc).append({i, static_cast<uint32_t>(loc), static_cast<uint32_t>(j)});
+		return true;
+	});
+	if (!fits) {
+		return false;
+	}
+	for (auto &group : groups) {
+		group.run->finish_writing();
+	}
+
+	// then every group of several slices is split up further, which keeps the
+	// records of each bucket in order, and every slice is filled in from its
+	// run, and its buckets are shuffled, in the same order as complete_hash
+	// shuffles them.
+	vector<bucket_slot> slice;
+	vector<HashRecord> records(buffer_records);
+	function<void(SliceGroup &)> build = [&](SliceGroup &group) {
+		if (group.slice_count > 1) {
+			vector<SliceGroup> parts = split(group.first_slice, group.slice_count);
+			group.run->read(records, [&](HashRecord &record) {
+				group_of(parts, record.bucket).append(record);
+			});
+			// the run isn't needed anymore, so its space is freed right away.
+			group.run.reset();
+			for (auto &part : parts) {
+				part.run->finish_writing();
+			}
+			for (auto &part : parts) {
+				build(part);
+			}
+			return;
+		}
+
+		size_t first_bucket = group.first_slice * slice_buckets;
+		size_t count = min(slice_buckets, bucket_count - first_bucket);
+		slice.assign(count * capacity, BUCKET_EMPTY);
+		fill(capacity_used.begin() + first_bucket, capacity_used.begin() + first_bucket + count, 0);
+		group.run->read(records, [&](HashRecord &record) {
+			size_t bucket = record.bucket - first_bucket;
+			slice[capacity * bucket + capacity_used[record.bucket]] = make_pair(record.input_index, record.seed_index);
+			capacity_used[record.bucket]++;
+		});
+		group.run.reset();
+
+		shuffle_buckets(random, slice, count, capacity);
+		on_slice(first_bucket, count, slice);
+	};
+	for (auto &group : groups) {
+		build(group);
 	}
 
 	return true;
@@ -1,5 +1,7 @@
 #pragma once
 #include <cstdint>
+#include <functional>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -9,6 +11,12 @@ typedef pair<size_t, size_t> bucket_slot;
 
 const bucket_slot BUCKET_EMPTY = make_pair(0xFFFFFFFFul, 0xFFFFFFFFul);
 
+/* The bucket (out of 2^m) of value under the hash function whose key is in aes.
+   loc_aes_hash_batch computes the buckets of count values at a time, so that
+   their blocks can be encrypted side by side. */
+size_t loc_aes_hash(AES &aes, size_t m, uint64_t value);
+void loc_aes_hash_batch(AES &aes, size_t m, const uint64_t *inputs, size_t count, uint64_t *locations);
+
 /* Given a set of inputs, a number of buckets, and seeds for a hash function,
    performs permutation-based cuckoo hashing to put at most one element in each
    bucket.
@@ -38,3 +46,26 @@ bool complete_hash(shared_ptr<UniformRandomGenerator> random,
                    size_t capacity,
                    vector<bucket_slot> &buckets,
                    vector<uint64_t> &seeds);
+
+/* Like complete_hash, but for tables that don't fit into memory: the table is
+   built in slices of consecutive buckets, using at most about memory_budget
+   bytes, and on_slice is called with every slice in order. The jth element of
+   bucket number first_bucket + i is stored in slice[i * capacity + j].
+   The inputs are hashed in one pass, which appends every (input_index,
+   seed_index) to a temporary file in temp_directory for the group of slices
+   that its bucket is in. At most 64 files are written at once, so groups of
+   several slices are split up in further passes until every file holds one
+   slice, from which the slice is built. The files' buffers come out of
+   memory_budget; the inputs and a counter per bucket don't. If the whole table
+   fits into memory_budget, it's built in memory, as one slice.
+   With random in the same state, the table is the same as complete_hash's.
+   Returns false, without calling on_slice, if a bucket overflows.
+*/
+bool complete_hash_slices(shared_ptr<UniformRandomGenerator> random,
+                          vector<uint64_t> &inputs,
+                          size_t m,
+                          size_t capacity,
+                          vector<uint64_t> &seeds,
+                          size_t memory_budget,
+                          const string &temp_directory,
+                          function<void(size_t first_bucket, size_t bucket_count, vector<bucket_slot> &slice)> on_slice);
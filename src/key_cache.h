@@ -0,0 +1,80 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "fingerprint.h"
+
+using namespace std;
+
+/*
+A KeyCache is the sender's LRU cache of receivers' keys (e.g. PublicKey or
+RelinKeys), identified by the fingerprints of their serializations. A receiver
+that has talked to the sender recently only needs to send the fingerprints of
+its keys instead of the keys themselves, which saves megabytes of transfer as
+well as the sender's time to deserialize them.
+
+The sender computes the fingerprint of every key it receives itself, so a
+receiver can't make the cache return a key for somebody else's fingerprint.
+
+Keys are handed out as shared_ptrs, so they stay valid for as long as they're
+used, even if they are evicted in the meantime. All methods are thread-safe.
+*/
+
+template <typename T>
+class KeyCache
+{
+public:
+    KeyCache(size_t capacity)
+        : capacity(capacity)
+    {}
+
+    /* returns nullptr if the key is not in the cache. */
+    shared_ptr<const T> find(const fingerprint_type &key_fingerprint)
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        auto position = index.find(key_fingerprint);
+        if (position == index.end()) {
+            return nullptr;
+        }
+
+        // move the entry to the front, i.e. mark it as the most recently used.
+        entries.splice(entries.begin(), entries, position->second);
+        return position->second->second;
+    }
+
+    void insert(const fingerprint_type &key_fingerprint, shared_ptr<const T> key)
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        auto position = index.find(key_fingerprint);
+        if (position != index.end()) {
+            entries.erase(position->second);
+            index.erase(position);
+        }
+
+        entries.emplace_front(key_fingerprint, key);
+        index[key_fingerprint] = entries.begin();
+        while (entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    size_t size()
+    {
+        lock_guard<mutex> lock(entries_mutex);
+        return entries.size();
+    }
+
+private:
+    typedef list<pair<fingerprint_type, shared_ptr<const T>>> entry_list;
+
+    size_t capacity;
+    // the most recently used entry comes first.
+    entry_list entries;
+    map<fingerprint_type, typename entry_list::iterator> index;
+    mutex entries_mutex;
+};
@@ -0,0 +1,175 @@
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "key_store.h"
+
+const uint64_t KEY_STORE_MAGIC = 0x4b455953544f5245ull; // 'KEYSTORE'
+const uint64_t KEY_STORE_HAS_RELIN_KEYS = 1;
+
+// every key is stored as the size of its serialization, the serialization
+// itself and the fingerprint of the serialization.
+bool read_key_section(istream &stream, string &bytes, fingerprint_type &bytes_fingerprint)
+{
+    uint64_t size;
+    stream.read(reinterpret_cast<char *>(&size), sizeof(size));
+    if (!stream) {
+        return false;
+    }
+
+    // don't trust the size before we've checked it against the file.
+    auto section_start = stream.tellg();
+    stream.seekg(0, ios::end);
+    auto remaining = static_cast<uint64_t>(stream.tellg() - section_start);
+    stream.seekg(section_start);
+    if (remaining < size + sizeof(fingerprint_type)) {
+        return false;
+    }
+
+    bytes.resize(size);
+    stream.read(&bytes[0], size);
+    stream.read(reinterpret_cast<char *>(bytes_fingerprint.data()), sizeof(bytes_fingerprint));
+    return stream && (bytes_fingerprint == fingerprint_bytes(bytes));
+}
+
+template <typename T>
+void write_key_section(ostream &stream, const T &key)
+{
+    stringstream key_stream;
+    key.save(key_stream);
+    string bytes = key_stream.str();
+
+    uint64_t size = bytes.size();
+    fingerprint_type bytes_fingerprint = fingerprint_bytes(bytes);
+    stream.write(reinterpret_cast<char *>(&size), sizeof(size));
+    stream.write(bytes.data(), bytes.size());
+    stream.write(reinterpret_cast<char *>(bytes_fingerprint.data()), sizeof(bytes_fingerprint));
+}
+
+// the fingerprints guarantee that these are the keys we saved, which were
+// valid, so there's no need to check them again.
+template <typename T>
+bool unsafe_load_bytes(T &key, string &bytes)
+{
+    stringstream stream(bytes);
+    try {
+        key.unsafe_load(stream);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+KeyStore::KeyStore(string directory)
+    : directory(directory)
+{
+#ifndef _WIN32
+    // this fails harmlessly if the directory already exists.
+    mkdir(directory.c_str(), 0700);
+#endif
+}
+
+string KeyStore::path(shared_ptr<SEALContext> context, string name)
+{
+    stringstream result;
+    result << directory << "/" << name << "-" << hex << setfill('0');
+    for (auto word : context->first_parms_id()) {
+        result << setw(16) << word;
+    }
+    return result.str();
+}
+
+optional<ReceiverKeys> KeyStore::load(shared_ptr<SEALContext> context)
+{
+    ifstream stream(path(context, "receiver-keys"), ios::binary);
+    if (!stream) {
+        return nullopt;
+    }
+
+    uint64_t magic, flags;
+    parms_id_type parms_id;
+    stream.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+    stream.read(reinterpret_cast<char *>(parms_id.data()), sizeof(parms_id));
+    stream.read(reinterpret_cast<char *>(&flags), sizeof(flags));
+    if (!stream || (magic != KEY_STORE_MAGIC) || (parms_id != context->first_parms_id())) {
+        return nullopt;
+    }
+
+    ReceiverKeys keys;
+    string bytes;
+    fingerprint_type secret_key_fingerprint;
+    if (!read_key_section(stream, bytes, secret_key_fingerprint)
+        || !unsafe_load_bytes(keys.secret_key, bytes)) {
+        return nullopt;
+    }
+    if (!read_key_section(stream, bytes, keys.public_key_fingerprint)
+        || !unsafe_load_bytes(keys.public_key, bytes)) {
+        return nullopt;
+    }
+    if (flags & KEY_STORE_HAS_RELIN_KEYS) {
+        keys.relin_keys.emplace();
+        if (!read_key_section(stream, bytes, keys.relin_keys_fingerprint)
+            || !unsafe_load_bytes(keys.relin_keys.value(), bytes)) {
+            return nullopt;
+        }
+    }
+    return keys;
+}
+
+void KeyStore::save(shared_ptr<SEALContext> context,
+                    const SecretKey &secret_key,
+                    const PublicKey &public_key,
+                    const RelinKeys *relin_keys)
+{
+    uint64_t magic = KEY_STORE_MAGIC;
+    parms_id_type parms_id = context->first_parms_id();
+    uint64_t flags = (relin_keys != nullptr) ? KEY_STORE_HAS_RELIN_KEYS : 0;
+
+    // we write to a temporary file and then rename it, so that nobody ever
+    // sees a half-written file, even if several receivers save at once.
+    static atomic<size_t> temporary_counter(0);
+    string final_path = path(context, "receiver-keys");
+    stringstream temporary_path;
+    temporary_path << final_path << ".tmp";
+#ifndef _WIN32
+    temporary_path << "." << getpid();
+#endif
+    temporary_path << "." << temporary_counter++;
+
+#ifndef _WIN32
+    // the file is created with access for nobody but us, so the secret key is
+    // never readable by others, not even briefly. O_EXCL also makes sure that
+    // we don't write through a file or link someone else put there.
+    int file = open(temporary_path.str().c_str(), O_CREAT | O_EXCL | O_WRONLY, 0600);
+    if (file < 0) {
+        return;
+    }
+    close(file);
+#endif
+    ofstream stream(temporary_path.str(), ios::binary | ios::trunc);
+    if (!stream) {
+        remove(temporary_path.str().c_str());
+        return;
+    }
+    stream.write(reinterpret_cast<char *>(&magic), sizeof(magic));
+    stream.write(reinterpret_cast<char *>(parms_id.data()), sizeof(parms_id));
+    stream.write(reinterpret_cast<char *>(&flags), sizeof(flags));
+    write_key_section(stream, secret_key);
+    write_key_section(stream, public_key);
+    if (relin_keys != nullptr) {
+        write_key_section(stream, *relin_keys);
+    }
+    stream.close();
+
+    if (!stream || (rename(temporary_path.str().c_str(), final_path.c_str()) != 0)) {
+        remove(temporary_path.str().c_str());
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "seal/seal.h"
+
+#include "fingerprint.h"
+
+using namespace std;
+using namespace seal;
+
+/*
+A KeyStore keeps the receiver's keys on disk, so that a receiver that talks to
+the same sender many times only generates them once. Keys are stored in one file
+per set of encryption parameters, identified by the parameters' parms_id.
+
+The keys are written in SEAL's own binary format, each followed by a fingerprint
+of its serialization. When loading, we check the fingerprints and then skip
+SEAL's (slow) validity checks on every coefficient of the keys. The same
+fingerprints identify the keys to a sender's KeyCache.
+
+NB: the files contain the receiver's secret key. On POSIX systems they are only
+readable by their owner, but the directory should be kept private anyway.
+*/
+
+struct ReceiverKeys
+{
+    SecretKey secret_key;
+    PublicKey public_key;
+    // empty if the keys were only ever used with parameters that don't need
+    // relinearization keys.
+    optional<RelinKeys> relin_keys;
+    fingerprint_type public_key_fingerprint;
+    fingerprint_type relin_keys_fingerprint;
+};
+
+class KeyStore
+{
+public:
+    /* the directory is created if it doesn't exist. */
+    KeyStore(string directory);
+
+    /* returns nothing if there are no (intact) keys for these parameters. */
+    optional<ReceiverKeys> load(shared_ptr<SEALContext> context);
+    /* saving is best effort: if the keys can't be written, they will simply
+       be generated again next time. safe to call from multiple threads. */
+    void save(shared_ptr<SEALContext> context,
+              const SecretKey &secret_key,
+              const PublicKey &public_key,
+              const RelinKeys *relin_keys = nullptr);
+
+    /* the path of the file with the given name that belongs to these
+       parameters, e.g. for other per-key state such as a ZeroPool. */
+    string path(shared_ptr<SEALContext> context, string name);
+
+private:
+    string directory;
+};
@@ -82,11 +82,14 @@ int main()
     if (labeled) {
         labels = sender_labels;
     }
+    RelinKeys relin_keys;
+    if (params.needs_relin_keys()) {
+        relin_keys = user.relin_keys();
+    }
+    server.set_database(sender_inputs, labels);
     auto sender_matches = server.compute_matches(
-        sender_inputs,
-        labels,
         user.public_key(),
-        user.relin_keys(),
+        relin_keys,
         receiver_encrypted_inputs
     );
 
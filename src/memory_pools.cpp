@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "memory_pools.h"
+
+// a thread's pool, which is registered for as long as the thread runs, so that
+// the stats can be collected from other threads.
+struct ThreadMemoryPool
+{
+    ThreadMemoryPool();
+    ~ThreadMemoryPool();
+
+    MemoryPoolHandle pool;
+};
+
+mutex &thread_memory_pools_mutex()
+{
+    static mutex pools_mutex;
+    return pools_mutex;
+}
+
+vector<ThreadMemoryPool *> &thread_memory_pools()
+{
+    static vector<ThreadMemoryPool *> pools;
+    return pools;
+}
+
+ThreadMemoryPool::ThreadMemoryPool()
+    : pool(MemoryPoolHandle::New())
+{
+    lock_guard<mutex> lock(thread_memory_pools_mutex());
+    thread_memory_pools().push_back(this);
+}
+
+ThreadMemoryPool::~ThreadMemoryPool()
+{
+    lock_guard<mutex> lock(thread_memory_pools_mutex());
+    auto &pools = thread_memory_pools();
+    pools.erase(find(pools.begin(), pools.end(), this));
+}
+
+MemoryPoolHandle thread_memory_pool()
+{
+    thread_local ThreadMemoryPool thread_pool;
+    return thread_pool.pool;
+}
+
+MemoryPoolStats thread_memory_pool_stats()
+{
+    MemoryPoolStats stats {0, 0, 0};
+    lock_guard<mutex> lock(thread_memory_pools_mutex());
+    for (ThreadMemoryPool *thread_pool : thread_memory_pools()) {
+        stats.pool_count++;
+        stats.allocation_sizes += thread_pool->pool.pool_count();
+        stats.allocated_bytes += thread_pool->pool.alloc_byte_count();
+    }
+    return stats;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+#include "seal/seal.h"
+
+using namespace std;
+using namespace seal;
+
+/*
+Every SEAL operation allocates its temporaries from a memory pool, by default
+from one global pool, which all threads have to take turns locking. Instead,
+the hot paths (computing powers, evaluating partitions, masking, encrypting and
+decrypting) use thread_memory_pool(), a pool that only the calling thread uses,
+and keep the ciphertexts and plaintexts they work on in buffers that are reused
+for every partition and every query.
+
+A SEAL pool keeps everything it has allocated until it's destroyed, and hands it
+out again for the next allocation of the same size. So once the hot paths have
+run once, their pools stop growing, and thread_memory_pool_stats() shows whether
+they do: if allocated_bytes is the same before and after a query, the query
+didn't need any new memory.
+*/
+
+/* the calling thread's pool, which lives as long as the thread does. */
+MemoryPoolHandle thread_memory_pool();
+
+struct MemoryPoolStats
+{
+    // the number of threads that have a pool.
+    size_t pool_count;
+    // the number of different allocation sizes the pools have served, summed
+    // over all pools.
+    size_t allocation_sizes;
+    // the bytes the pools hold, which is the most they have ever used at once.
+    size_t allocated_bytes;
+};
+
+/* the sum over the pools of all threads that are still running. */
+MemoryPoolStats thread_memory_pool_stats();
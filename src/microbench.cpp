@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boost/asio.hpp"
+
+#include "bit_packing.h"
+#include "hashing.h"
+#include "networking.h"
+#include "polynomials.h"
+#include "psi.h"
+#include "random.h"
+#include "test_utils.h"
+#include "windowing.h"
+
+using namespace std;
+using namespace boost::asio;
+
+/*
+microbench times the protocol's kernels one at a time, at the sizes that they
+run at in a query, so that a change in the performance of a whole query (see
+benchmark) can be pinned on one of them.
+
+Every kernel is called repeatedly for at least the minimum time per
+repetition, and the time per operation (e.g. per input hashed, or per
+ciphertext) is summarized over the repetitions. Kernels that need fresh
+inputs for every call get them from a setup function, which isn't timed.
+*/
+
+struct BenchmarkOptions
+{
+    size_t repetitions;
+    double min_seconds;
+    // only the kernels whose names contain this are run.
+    string filter;
+};
+
+struct Summary
+{
+    double median;
+    double mean;
+    double min;
+    double stddev;
+};
+
+Summary summarize(vector<double> values)
+{
+    sort(values.begin(), values.end());
+    size_t count = values.size();
+    Summary summary;
+    summary.median = (count % 2 == 1) ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+    summary.min = values[0];
+    summary.mean = 0;
+    for (double value : values) {
+        summary.mean += value;
+    }
+    summary.mean /= count;
+    double variance = 0;
+    for (double value : values) {
+        variance += (value - summary.mean) * (value - summary.mean);
+    }
+    summary.stddev = (count > 1) ? sqrt(variance / (count - 1)) : 0;
+    return summary;
+}
+
+void print_header()
+{
+    cout << left << setw(50) << "kernel" << right
+         << setw(6) << "reps"
+         << setw(16) << "ns/op median"
+         << setw(10) << "stddev"
+         << setw(16) << "ns/op min"
+         << setw(16) << "ops/s"
+         << setw(12) << "MB/s" << endl;
+}
+
+/* every call of call performs ops_per_call operations on bytes_per_call bytes.
+   if setup is given, it's called before every call, untimed. */
+void run_benchmark(BenchmarkOptions &options,
+                   const string &name,
+                   size_t ops_per_call,
+                   size_t bytes_per_call,
+                   function<void()> call,
+                   function<void()> setup = nullptr)
+{
+    if (name.find(options.filter) == string::npos) {
+        return;
+    }
+
+    // times calls_per_repetition calls, excluding their setups.
+    auto time_calls = [&](size_t call_count) {
+        std::chrono::steady_clock::duration elapsed(0);
+        if (setup) {
+            for (size_t i = 0; i < call_count; i++) {
+                setup();
+                auto start = std::chrono::steady_clock::now();
+                call();
+                elapsed += std::chrono::steady_clock::now() - start;
+            }
+        } else {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < call_count; i++) {
+                call();
+            }
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        return std::chrono::duration<double>(elapsed).count();
+    };
+
+    // the first call warms up the caches (and the memory pools), and tells us
+    // how many calls make up a repetition.
+    double first_seconds = time_calls(1);
+    size_t calls_per_repetition = max<size_t>(1, options.min_seconds / max(first_seconds, 1e-9));
+
+    vector<double> ns_per_op(options.repetitions);
+    for (size_t repetition = 0; repetition < options.repetitions; repetition++) {
+        double seconds = time_calls(calls_per_repetition);
+        ns_per_op[repetition] = seconds * 1e9 / (calls_per_repetition * ops_per_call);
+    }
+
+    Summary summary = summarize(ns_per_op);
+    double ops_per_second = 1e9 / summary.median;
+    double bytes_per_second = ops_per_second * bytes_per_call / ops_per_call;
+    cout << left << setw(50) << name << right
+         << setw(6) << options.repetitions
+         << setw(16) << fixed << setprecision(1) << summary.median
+         << setw(9) << setprecision(1) << (100 * summary.stddev / summary.mean) << "%"
+         << setw(16) << summary.min
+         << setw(16) << setprecision(0) << ops_per_second
+         << setw(12) << setprecision(1) << bytes_per_second / 1e6 << endl;
+}
+
+size_t ciphertexts_size(PSIParams &params, vector<Ciphertext> &ciphertexts, bool packed)
+{
+    size_t size = 0;
+    for (auto &ciphertext : ciphertexts) {
+        size += Networking::ciphertext_size(params.context, ciphertext, packed);
+    }
+    return size;
+}
+
+int main(int argc, char **argv)
+{
+    // the options come first.
+    BenchmarkOptions options {10, 0.2, ""};
+    size_t sender_size = 1 << 20;
+    size_t thread_count = 0;
+    while ((argc >= 3) && (argv[1][0] == '-')) {
+        string option = argv[1];
+        if (option == "--repetitions") {
+            options.repetitions = stoul(argv[2]);
+        } else if (option == "--min-time") {
+            options.min_seconds = stod(argv[2]);
+        } else if (option == "--sender-size") {
+            sender_size = stoul(argv[2]);
+        } else if (option == "--threads") {
+            thread_count = stoul(argv[2]);
+        } else {
+            break;
+        }
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    if ((argc > 2) || ((argc == 2) && (argv[1][0] == '-')) || (options.repetitions == 0)) {
+        cout << "USAGE: " << argv[0] << " [--repetitions count] [--min-time seconds]"
+             << " [--sender-size size] [--threads count] [filter]" << endl;
+        cout << "runs every kernel whose name contains filter (all of them by"
+             << " default) for repetitions (10) repetitions of at least"
+             << " min-time (0.2) seconds each, with the params of a query"
+             << " against a labeled set of sender-size (2^20) items." << endl;
+        return 1;
+    }
+    if (argc == 2) {
+        options.filter = argv[1];
+    }
+
+    // the params and sets of a typical query, as in pc_server.
+    size_t receiver_size = 5535;
+    size_t input_bits = 32;
+    PSIParams params(receiver_size, sender_size, input_bits, 8192);
+    params.set_sender_partition_count(min<size_t>(16, params.sender_bucket_capacity()));
+    params.generate_seeds();
+    uint64_t plain_modulus = params.plain_modulus();
+    size_t bucket_count_log = params.bucket_count_log();
+    size_t bucket_count = (1 << bucket_count_log);
+    size_t capacity = params.sender_bucket_capacity();
+    size_t partition_size = params.max_partition_size();
+
+    ThreadPool pool(thread_count);
+    Dataset dataset;
+    generate_dataset(0, input_bits, sender_size, receiver_size, 50, 1, params.label_chunk_bits(), pool, dataset);
+    auto random = UniformRandomGeneratorFactory::default_factory()->create();
+
+    cout << "sender size " << sender_size << ", receiver size " << receiver_size << ", " << bucket_count
+         << " buckets, capacity " << capacity << ", " << params.sender_partition_count() << " partitions of up to "
+         << partition_size << " rows, " << pool.thread_count() << " threads" << endl;
+    print_header();
+
+    // hashing
+    AES aes;
+    aes.set_key(0, params.seeds[0]);
+    vector<uint64_t> hash_inputs(dataset.sender_inputs.begin(), dataset.sender_inputs.begin() + min<size_t>(4096, sender_size));
+    vector<uint64_t> locations(hash_inputs.size());
+    run_benchmark(options, "loc_aes_hash", hash_inputs.size(), hash_inputs.size() * sizeof(uint64_t), [&] {
+        for (size_t i = 0; i < hash_inputs.size(); i++) {
+            locations[i] = loc_aes_hash(aes, bucket_count_log, hash_inputs[i]);
+        }
+    });
+    run_benchmark(options, "loc_aes_hash_batch", hash_inputs.size(), hash_inputs.size() * sizeof(uint64_t), [&] {
+        loc_aes_hash_batch(aes, bucket_count_log, hash_inputs.data(), hash_inputs.size(), locations.data());
+    });
+
+    vector<bucket_slot> sender_buckets;
+    run_benchmark(options, "complete_hash", sender_size, sender_size * sizeof(uint64_t), [&] {
+        complete_hash(random, dataset.sender_inputs, bucket_count_log, capacity, sender_buckets, params.seeds);
+    });
+    vector<bucket_slot> receiver_buckets;
+    run_benchmark(options, "cuckoo_hash", receiver_size, receiver_size * sizeof(uint64_t), [&] {
+        cuckoo_hash(random, dataset.receiver_inputs, bucket_count_log, receiver_buckets, params.seeds);
+    });
+
+    // interpolation, with a partition's worth of points
+    vector<uint64_t> xs(partition_size), ys(partition_size), coeffs;
+    for (size_t i = 0; i < partition_size; i++) {
+        xs[i] = random_integer(random, plain_modulus);
+        ys[i] = random_integer(random, plain_modulus);
+    }
+    run_benchmark(options, "polynomial_from_roots", 1, partition_size * sizeof(uint64_t), [&] {
+        polynomial_from_roots(xs, coeffs, plain_modulus);
+    });
+    run_benchmark(options, "polynomial_from_points", 1, 2 * partition_size * sizeof(uint64_t), [&] {
+        polynomial_from_points(xs, ys, coeffs, plain_modulus);
+    });
+
+    vector<uint64_t> bases(4096), exponents(4096);
+    for (size_t i = 0; i < bases.size(); i++) {
+        bases[i] = random_integer(random, plain_modulus);
+        exponents[i] = random_integer(random, plain_modulus);
+    }
+    uint64_t powers_sum = 0;
+    run_benchmark(options, "modexp", bases.size(), bases.size() * sizeof(uint64_t), [&] {
+        for (size_t i = 0; i < bases.size(); i++) {
+            powers_sum += modexp(bases[i], exponents[i], plain_modulus);
+        }
+    });
+
+    // the receiver's side of a query
+    PSIReceiver receiver(params, thread_count);
+    RelinKeys relin_keys;
+    if (params.needs_relin_keys()) {
+        relin_keys = receiver.relin_keys();
+    }
+    Encryptor encryptor(params.context, receiver.public_key());
+    BatchEncoder encoder(params.context);
+    Evaluator evaluator(params.context);
+    vector<uint64_t> encoded_buckets(bucket_count);
+    for (auto &value : encoded_buckets) {
+        value = random_integer(random, plain_modulus);
+    }
+    Windowing windowing = params.windowing();
+    vector<Ciphertext> windows;
+    windowing.prepare(encoded_buckets, windows, plain_modulus, encoder, encryptor, nullptr, pool);
+    run_benchmark(options, "Windowing::prepare", windows.size(), ciphertexts_size(params, windows, false), [&] {
+        windowing.prepare(encoded_buckets, windows, plain_modulus, encoder, encryptor, nullptr, pool);
+    });
+
+    // compute_powers leaves powers[0] alone.
+    vector<Ciphertext> powers(partition_size + 1);
+    windowing.compute_powers(windows, powers, evaluator, relin_keys, pool);
+    vector<Ciphertext> computed_powers(powers.begin() + 1, powers.end());
+    run_benchmark(options, "Windowing::compute_powers", partition_size,
+                  ciphertexts_size(params, computed_powers, false), [&] {
+        windowing.compute_powers(windows, powers, evaluator, relin_keys, pool);
+    });
+
+    // the sender's side of a query, against a database that only holds the
+    // first partition. the powers are computed as part of it, so the
+    // partition's own cost is the difference to compute_powers.
+    optional<vector<vector<uint64_t>>> labels = dataset.sender_labels;
+    auto database = make_shared<SenderDatabase>(params, dataset.sender_inputs, labels, pool, nullptr, 0, 1);
+    PSISender sender(params, database, pool);
+    vector<Ciphertext> query_windows = receiver.encrypt_inputs(dataset.receiver_inputs, receiver_buckets);
+    size_t coefficient_bytes = (partition_size + 1) * (1 + params.label_chunks().size()) * bucket_count * sizeof(uint64_t);
+    run_benchmark(options, "compute_matches (1 partition, with powers)", 1, coefficient_bytes, [&] {
+        sender.compute_matches(receiver.public_key(), relin_keys, query_windows);
+    });
+
+    Ciphertext result = windows[0];
+    run_benchmark(options, "multiply_by_random_mask", 1, ciphertexts_size(params, windows, false) / windows.size(),
+                  [&] {
+        multiply_by_random_mask(result, random, encoder, evaluator, plain_modulus);
+    });
+
+    // serialization, in memory and through a socket
+    // unpack_ciphertext needs a ciphertext of the right shape.
+    Ciphertext unpacked = windows[0];
+    size_t packed_size = packed_ciphertext_size(params.context, windows[0]);
+    vector<uint8_t> packed(packed_size);
+    run_benchmark(options, "pack_ciphertext", 1, packed_size, [&] {
+        pack_ciphertext(params.context, windows[0], packed.data());
+    });
+    run_benchmark(options, "unpack_ciphertext", 1, packed_size, [&] {
+        unpack_ciphertext(params.context, packed.data(), unpacked);
+    });
+
+    io_context context;
+    vector<pair<string, uint32_t>> transports = {
+        {"Networking ciphertexts", 0},
+        {"Networking ciphertexts (packed)", NET_FEATURE_PACKED_CIPHERTEXTS},
+        {"Networking ciphertexts (packed, shared memory)", NET_FEATURES_ALL},
+    };
+    for (auto &transport : transports) {
+        local::stream_protocol::socket writer_socket(context), reader_socket(context);
+        local::connect_pair(writer_socket, reader_socket);
+        Networking writer(move(writer_socket), transport.second);
+        Networking reader(move(reader_socket), transport.second);
+        writer.set_seal_context(params.context);
+        reader.set_seal_context(params.context);
+        writer.write_hello();
+        writer.flush();
+        reader.write_hello();
+        reader.flush();
+        writer.read_hello();
+        reader.read_hello();
+
+        // a query's windows are written on one thread and read on another.
+        size_t bytes = ciphertexts_size(params, windows, writer.packs_ciphertexts());
+        Ciphertext received;
+        run_benchmark(options, transport.first, windows.size(), bytes, [&] {
+            thread writing([&] {
+                for (auto &window : windows) {
+                    writer.write_ciphertext(window);
+                }
+                writer.flush();
+            });
+            for (size_t i = 0; i < windows.size(); i++) {
+                reader.read_ciphertext(received);
+            }
+            writing.join();
+        });
+    }
+
+    // keeps the compiler from dropping the modexps.
+    if (powers_sum == 1) {
+        cout << endl;
+    }
+    return 0;
+}
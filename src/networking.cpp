@@ -1,5 +1,14 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
 
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bit_packing.h"
 #include "networking.h"
 
 const uint64_t NET_MAGIC_HELLO = 0x5052495643415453ull; // 'PRIVCATS'
@@ -8,33 +17,383 @@ const uint32_t NET_MAGIC_CIPHERTEXT = 0x63697074ul; // 'cipt'
 const uint32_t NET_MAGIC_VECTOR_CIPHERTEXT = 0x76636970ul; // 'vcip'
 const uint32_t NET_MAGIC_PUBLIC_KEY = 0x706b6579ul; // 'pkey'
 const uint32_t NET_MAGIC_RELIN_KEYS = 0x72656c6eul; // 'reln'
+const uint32_t NET_MAGIC_FINGERPRINT = 0x66707274ul; // 'fprt'
+
+// the magic, parms_id, size and NTT flag.
+const size_t NET_CIPHERTEXT_HEADER_SIZE = 4 + sizeof(parms_id_type) + 4 + 4;
+
+// we read at least this many bytes at a time, if they are available.
+const size_t NET_READ_CHUNK_SIZE = 1 << 16;
+
+// instead of the position in the other side's ring, which says where a shared
+// ciphertext's coefficients are.
+const uint64_t NET_CIPHERTEXT_INLINE = UINT64_MAX;
+
+const string NET_UNIX_ADDRESS_PREFIX = "unix:";
+
+void encode_uint32(uint32_t value, uint8_t *bytes) {
+    bytes[0] = value >> 24;
+    bytes[1] = (value >> 16) & 0xFF;
+    bytes[2] = (value >> 8) & 0xFF;
+    bytes[3] = (value) & 0xFF;
+}
+
+uint32_t decode_uint32(uint8_t *bytes) {
+    return ((uint32_t) bytes[3]
+            | ((uint32_t) bytes[2] << 8)
+            | ((uint32_t) bytes[1] << 16)
+            | ((uint32_t) bytes[0] << 24));
+}
 
-Networking::Networking(ip::tcp::socket &socket)
-    : socket(socket), read_stream(&read_buffer), write_stream(&write_buffer)
+bool is_unix_address(const string &address) {
+    return address.compare(0, NET_UNIX_ADDRESS_PREFIX.size(), NET_UNIX_ADDRESS_PREFIX) == 0;
+}
+
+void split_address(const string &address, string &host, string &port) {
+    assert(!is_unix_address(address));
+    size_t colon = address.rfind(':');
+    assert(colon != string::npos);
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+}
+
+string unix_address_path(const string &address) {
+    assert(is_unix_address(address));
+    return address.substr(NET_UNIX_ADDRESS_PREFIX.size());
+}
+
+/* the byte stream that the messages go over. */
+class Transport
+{
+public:
+    virtual ~Transport() {}
+    virtual size_t read_some(const mutable_buffer &buffer) = 0;
+    virtual size_t write_some(const vector<const_buffer> &buffers) = 0;
+
+    /* only a local transport can pass file descriptors, which are sent along
+       with the next write, and received by whichever read gets the first byte
+       of that write. */
+    virtual bool is_local() {
+        return false;
+    }
+    virtual void send_fd(int) {
+        throw logic_error("only a local transport can pass file descriptors");
+    }
+    /* the last file descriptor that was received and not taken yet, or -1. */
+    virtual int take_received_fd() {
+        return -1;
+    }
+};
+
+class TcpTransport : public Transport
+{
+public:
+    TcpTransport(ip::tcp::socket socket) : socket(move(socket)) {}
+
+    size_t read_some(const mutable_buffer &buffer) override {
+        return socket.read_some(buffer);
+    }
+
+    size_t write_some(const vector<const_buffer> &buffers) override {
+        return socket.write_some(buffers);
+    }
+
+private:
+    ip::tcp::socket socket;
+};
+
+// asio can't pass file descriptors, so this uses sendmsg and recvmsg directly.
+class UnixTransport : public Transport
+{
+public:
+    UnixTransport(local::stream_protocol::socket socket)
+        : socket(move(socket)), fd_to_send(-1), received_fd(-1)
+    {}
+
+    ~UnixTransport() {
+        if (received_fd >= 0) {
+            close(received_fd);
+        }
+    }
+
+    size_t read_some(const mutable_buffer &buffer) override {
+        iovec part = {buffer.data(), buffer.size()};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        msghdr message = {};
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t received = retry(POLLIN, [&] {
+            return recvmsg(socket.native_handle(), &message, MSG_CMSG_CLOEXEC);
+        });
+        if (received == 0) {
+            throw boost::system::system_error(boost::asio::error::eof);
+        }
+
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        if ((header != nullptr) && (header->cmsg_level == SOL_SOCKET) && (header->cmsg_type == SCM_RIGHTS)) {
+            if (received_fd >= 0) {
+                close(received_fd);
+            }
+            memcpy(&received_fd, CMSG_DATA(header), sizeof(int));
+        }
+        return received;
+    }
+
+    size_t write_some(const vector<const_buffer> &buffers) override {
+        vector<iovec> parts(min<size_t>(buffers.size(), NET_MAX_PARTS));
+        for (size_t i = 0; i < parts.size(); i++) {
+            parts[i] = {const_cast<void *>(buffers[i].data()), buffers[i].size()};
+        }
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        msghdr message = {};
+        message.msg_iov = parts.data();
+        message.msg_iovlen = parts.size();
+        if (fd_to_send >= 0) {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            cmsghdr *header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(header), &fd_to_send, sizeof(int));
+        }
+        ssize_t written = retry(POLLOUT, [&] {
+            return sendmsg(socket.native_handle(), &message, MSG_NOSIGNAL);
+        });
+        fd_to_send = -1;
+        return written;
+    }
+
+    bool is_local() override {
+        return true;
+    }
+
+    void send_fd(int fd) override {
+        fd_to_send = fd;
+    }
+
+    int take_received_fd() override {
+        int fd = received_fd;
+        received_fd = -1;
+        return fd;
+    }
+
+private:
+    // like asio, we write at most this many parts at a time.
+    static const size_t NET_MAX_PARTS = 64;
+
+    // calls a system call until it succeeds, waiting for the socket to become
+    // ready if it's non-blocking.
+    template <typename SystemCall>
+    ssize_t retry(short events, SystemCall system_call) {
+        while (true) {
+            ssize_t result = system_call();
+            if (result >= 0) {
+                return result;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                pollfd ready = {socket.native_handle(), events, 0};
+                poll(&ready, 1, -1);
+            } else if (errno != EINTR) {
+                throw boost::system::system_error(
+                    boost::system::error_code(errno, boost::system::system_category()));
+            }
+        }
+    }
+
+    local::stream_protocol::socket socket;
+    int fd_to_send;
+    int received_fd;
+};
+
+Networking::Networking(ip::tcp::socket socket, uint32_t features)
+    : transport(make_unique<TcpTransport>(move(socket))),
+      read_stream(&read_buffer),
+      message_remaining(0),
+      write_stream(&write_buffer),
+      write_external_size(0),
+      // memory can only be shared with the same host.
+      features(features & ~NET_FEATURE_SHARED_MEMORY)
+{}
+
+Networking::Networking(local::stream_protocol::socket socket, uint32_t features)
+    : transport(make_unique<UnixTransport>(move(socket))),
+      read_stream(&read_buffer),
+      message_remaining(0),
+      write_stream(&write_buffer),
+      write_external_size(0),
+      features(features)
 {}
 
+Networking::~Networking() {}
+
+unique_ptr<Networking> Networking::connect_to(io_context &context, const string &address, uint32_t features) {
+    if (is_unix_address(address)) {
+        local::stream_protocol::socket socket(context);
+        socket.connect(local::stream_protocol::endpoint(unix_address_path(address)));
+        return make_unique<Networking>(move(socket), features);
+    }
+
+    string host, port;
+    split_address(address, host, port);
+    ip::tcp::socket socket(context);
+    ip::tcp::resolver resolver(context);
+    connect(socket, resolver.resolve(host, port));
+    return make_unique<Networking>(move(socket), features);
+}
+
 void Networking::set_seal_context(shared_ptr<SEALContext> new_context) {
     seal_context = new_context;
 }
 
+void Networking::flush() {
+    size_t buffered_length = write_buffer.size();
+    size_t length = buffered_length + write_external_size;
+    if (length == 0) {
+        return;
+    }
+    assert(length <= UINT32_MAX);
+
+    // the message consists of its length, then the buffered bytes, with the
+    // external parts inserted into them at the right places.
+    uint8_t header[4];
+    encode_uint32(length, header);
+    vector<const_buffer> message = {boost::asio::buffer(header)};
+    const char *buffered = static_cast<const char *>(write_buffer.data().data());
+    size_t buffered_start = 0;
+    for (auto &external : write_external) {
+        if (external.first > buffered_start) {
+            message.push_back(boost::asio::buffer(buffered + buffered_start, external.first - buffered_start));
+        }
+        message.push_back(external.second);
+        buffered_start = external.first;
+    }
+    if (buffered_length > buffered_start) {
+        message.push_back(boost::asio::buffer(buffered + buffered_start, buffered_length - buffered_start));
+    }
+
+    // boost::asio::write splits everything into 64 KiB writes, so we use
+    // write_some directly, which writes as much as the socket will take.
+    size_t remaining = sizeof(header) + length;
+    while (remaining > 0) {
+        size_t written = transport->write_some(message);
+        remaining -= written;
+
+        // drop whatever has been written from the front of the message.
+        size_t written_parts = 0;
+        while ((written_parts < message.size()) && (written >= message[written_parts].size())) {
+            written -= message[written_parts].size();
+            written_parts++;
+        }
+        message.erase(message.begin(), message.begin() + written_parts);
+        if (written > 0) {
+            message.front() += written;
+        }
+    }
+
+    write_buffer.consume(buffered_length);
+    write_external.clear();
+    write_external_size = 0;
+}
+
+void Networking::receive(size_t byte_count) {
+    while (read_buffer.size() < byte_count) {
+        // the other side might be waiting for whatever we haven't sent yet.
+        flush();
+        size_t missing = byte_count - read_buffer.size();
+        auto buffer = read_buffer.prepare(max(missing, NET_READ_CHUNK_SIZE));
+        read_buffer.commit(transport->read_some(buffer));
+    }
+}
+
+void Networking::start_reading() {
+    if (message_remaining > 0) {
+        return;
+    }
+
+    uint8_t header[4];
+    receive(sizeof(header));
+    read_stream.read(reinterpret_cast<char *>(header), sizeof(header));
+    message_remaining = decode_uint32(header);
+    if (message_remaining == 0) {
+        throw invalid_argument("empty message");
+    }
+}
+
+void Networking::read_bytes(void *destination, size_t byte_count) {
+    start_reading();
+    // nothing is ever split between messages.
+    if (byte_count > message_remaining) {
+        throw invalid_argument("read past the end of a message");
+    }
+    receive(byte_count);
+    read_stream.read(static_cast<char *>(destination), byte_count);
+    message_remaining -= byte_count;
+}
+
+void Networking::read_bytes_direct(void *destination, size_t byte_count) {
+    start_reading();
+    if (byte_count > message_remaining) {
+        throw invalid_argument("read past the end of a message");
+    }
+
+    char *bytes = static_cast<char *>(destination);
+    size_t buffered = min(byte_count, read_buffer.size());
+    read_stream.read(bytes, buffered);
+    if (buffered < byte_count) {
+        flush();
+    }
+    for (size_t received = buffered; received < byte_count; ) {
+        received += transport->read_some(boost::asio::buffer(bytes + received, byte_count - received));
+    }
+    message_remaining -= byte_count;
+}
+
+void Networking::write_bytes_external(const void *data, size_t byte_count) {
+    write_external.emplace_back(write_buffer.size(), boost::asio::buffer(data, byte_count));
+    write_external_size += byte_count;
+}
+
+template <typename T>
+void Networking::read_object(T &object, fingerprint_type *object_fingerprint, size_t max_size) {
+    assert(seal_context);
+    start_reading();
+
+    // SEAL's serialization doesn't say how long it is, so we have to receive
+    // the rest of the message before parsing it. afterwards, the object's
+    // serialization is still in memory. the other side declares how long the
+    // message is, so that's checked first.
+    if (message_remaining > max_size) {
+        throw invalid_argument("received a " + to_string(message_remaining) + " byte object, expected at most "
+                               + to_string(max_size));
+    }
+    receive(message_remaining);
+    const char *start = static_cast<const char *>(read_buffer.data().data());
+    size_t size_before = read_buffer.size();
+    object.load(seal_context, read_stream);
+    size_t consumed = size_before - read_buffer.size();
+    if (consumed > message_remaining) {
+        throw invalid_argument("object larger than its message");
+    }
+    message_remaining -= consumed;
+
+    if (object_fingerprint != nullptr) {
+        *object_fingerprint = fingerprint_bytes(string(start, consumed));
+    }
+}
+
 uint32_t Networking::read_uint32() {
     uint8_t bytes[4];
-    auto transferred = read(socket, boost::asio::buffer(&bytes, 4));
-    assert(transferred == 4);
-    return ((uint32_t) bytes[3]
-            | ((uint32_t) bytes[2] << 8)
-            | ((uint32_t) bytes[1] << 16)
-            | ((uint32_t) bytes[0] << 24));
+    read_bytes(bytes, sizeof(bytes));
+    return decode_uint32(bytes);
 }
 
 void Networking::write_uint32(uint32_t value) {
     uint8_t bytes[4];
-    bytes[0] = value >> 24;
-    bytes[1] = (value >> 16) & 0xFF;
-    bytes[2] = (value >> 8) & 0xFF;
-    bytes[3] = (value) & 0xFF;
-    auto transferred = write(socket, boost::asio::buffer(&bytes, 4));
-    assert(transferred == 4);
+    encode_uint32(value, bytes);
+    write_stream.write(reinterpret_cast<char *>(bytes), sizeof(bytes));
 }
 
 uint64_t Networking::read_uint64() {
@@ -48,36 +407,153 @@ void Networking::write_uint64(uint64_t value) {
     write_uint32(value & 0xFFFFFFFFull);
 }
 
+void Networking::read_magic(uint32_t magic) {
+    uint32_t received = read_uint32();
+    if (received != magic) {
+        throw invalid_argument("expected magic " + to_string(magic) + ", got " + to_string(received));
+    }
+}
+
 void Networking::read_hello() {
-    assert(read_uint64() == NET_MAGIC_HELLO);
+    if (read_uint64() != NET_MAGIC_HELLO) {
+        throw invalid_argument("expected a hello");
+    }
+    features &= read_uint32();
+
+    // the other side's ring came with its hello.
+    if (shares_memory()) {
+        int fd = transport->take_received_fd();
+        if (fd < 0) {
+            throw invalid_argument("no shared memory ring received");
+        }
+        read_ring = SharedMemoryRing::open(fd);
+    } else {
+        write_ring.reset();
+    }
 }
 
 void Networking::write_hello() {
     write_uint64(NET_MAGIC_HELLO);
+    write_uint32(features);
+
+    // if we haven't read the other side's hello yet, we don't know whether
+    // it'll use our ring, but we have to send it now anyway.
+    if (shares_memory()) {
+        write_ring = SharedMemoryRing::create(NET_SHARED_MEMORY_SIZE);
+        transport->send_fd(write_ring->fd());
+    }
+}
+
+bool Networking::packs_ciphertexts() {
+    return (features & NET_FEATURE_PACKED_CIPHERTEXTS) != 0;
+}
+
+bool Networking::shares_memory() {
+    return (features & NET_FEATURE_SHARED_MEMORY) != 0;
+}
+
+size_t Networking::ciphertext_size(shared_ptr<SEALContext> context, const Ciphertext &ciphertext, bool packed) {
+    size_t coefficients_size = packed
+                               ? packed_ciphertext_size(context, ciphertext)
+                               : ciphertext.uint64_count() * sizeof(uint64_t);
+    return NET_CIPHERTEXT_HEADER_SIZE + coefficients_size;
 }
 
 void Networking::read_ciphertext(Ciphertext &ciphertext) {
     assert(seal_context);
-    assert(read_uint32() == NET_MAGIC_CIPHERTEXT);
-    uint32_t length = read_uint32();
-    auto transferred = read(socket, read_buffer, transfer_exactly(length));
-    assert(transferred == length);
-    ciphertext.load(seal_context, read_stream);
+    read_magic(NET_MAGIC_CIPHERTEXT);
+    parms_id_type parms_id;
+    for (size_t i = 0; i < parms_id.size(); i++) {
+        parms_id[i] = read_uint64();
+    }
+    uint32_t size = read_uint32();
+    uint32_t is_ntt_form = read_uint32();
+
+    uint64_t position = shares_memory() ? read_uint64() : NET_CIPHERTEXT_INLINE;
+
+    // this only reallocates if the ciphertext's capacity is too small.
+    ciphertext.resize(seal_context, parms_id, size);
+    ciphertext.is_ntt_form() = (is_ntt_form != 0);
+    if (position != NET_CIPHERTEXT_INLINE) {
+        // the coefficients are copied out of the ring before they're checked,
+        // since the other side could still change them in there.
+        size_t byte_count = packs_ciphertexts()
+                            ? packed_ciphertext_size(seal_context, ciphertext)
+                            : ciphertext.uint64_count() * sizeof(uint64_t);
+        const uint8_t *source = read_ring->at(position, byte_count);
+        if (packs_ciphertexts()) {
+            unpack_ciphertext(seal_context, source, ciphertext);
+        } else {
+            memcpy(ciphertext.data(), source, byte_count);
+        }
+        read_ring->release(position + byte_count);
+    } else if (packs_ciphertexts()) {
+        // the packed coefficients are unpacked straight out of the buffer.
+        size_t byte_count = packed_ciphertext_size(seal_context, ciphertext);
+        start_reading();
+        if (byte_count > message_remaining) {
+            throw invalid_argument("read past the end of a message");
+        }
+        receive(byte_count);
+        unpack_ciphertext(seal_context, static_cast<const uint8_t *>(read_buffer.data().data()), ciphertext);
+        read_buffer.consume(byte_count);
+        message_remaining -= byte_count;
+    } else {
+        read_bytes_direct(ciphertext.data(), ciphertext.uint64_count() * sizeof(uint64_t));
+    }
+    // in particular, this checks that every coefficient is reduced.
+    if (!ciphertext.is_valid_for(seal_context)) {
+        throw invalid_argument("invalid ciphertext");
+    }
 }
 
-void Networking::write_ciphertext(Ciphertext &ciphertext) {
+void Networking::write_ciphertext(const Ciphertext &ciphertext) {
+    // we only use BFV, so there is no need to send the scale, which is only
+    // used by CKKS.
     write_uint32(NET_MAGIC_CIPHERTEXT);
-    ciphertext.save(write_stream);
-    uint32_t length = write_buffer.size();
-    write_uint32(length);
-    auto transferred = write(socket, write_buffer, transfer_exactly(length));
-    assert(transferred == length);
-    write_buffer.consume(length);
+    for (size_t i = 0; i < ciphertext.parms_id().size(); i++) {
+        write_uint64(ciphertext.parms_id()[i]);
+    }
+    write_uint32(ciphertext.size());
+    write_uint32(ciphertext.is_ntt_form() ? 1 : 0);
+
+    if (shares_memory()) {
+        assert(seal_context);
+        size_t byte_count = packs_ciphertexts()
+                            ? packed_ciphertext_size(seal_context, ciphertext)
+                            : ciphertext.uint64_count() * sizeof(uint64_t);
+        uint64_t position;
+        uint8_t *destination = write_ring->allocate(byte_count, position);
+        if (destination != nullptr) {
+            if (packs_ciphertexts()) {
+                pack_ciphertext(seal_context, ciphertext, destination);
+            } else {
+                memcpy(destination, ciphertext.data(), byte_count);
+            }
+            write_uint64(position);
+            return;
+        }
+        write_uint64(NET_CIPHERTEXT_INLINE);
+    }
+
+    if (packs_ciphertexts()) {
+        assert(seal_context);
+        size_t byte_count = packed_ciphertext_size(seal_context, ciphertext);
+        auto buffer = write_buffer.prepare(byte_count);
+        pack_ciphertext(seal_context, ciphertext, static_cast<uint8_t *>(buffer.data()));
+        write_buffer.commit(byte_count);
+    } else {
+        write_bytes_external(ciphertext.data(), ciphertext.uint64_count() * sizeof(uint64_t));
+    }
 }
 
-void Networking::read_uint64s(vector<uint64_t> &values) {
-    assert(read_uint32() == NET_MAGIC_VECTOR_UINT64);
+void Networking::read_uint64s(vector<uint64_t> &values, size_t max_length) {
+    read_magic(NET_MAGIC_VECTOR_UINT64);
     uint32_t length = read_uint32();
+    if (length > max_length) {
+        throw invalid_argument("received " + to_string(length) + " values, expected at most "
+                               + to_string(max_length));
+    }
     values.resize(length);
     for (size_t i = 0; i < length; i++) {
         values[i] = read_uint64();
@@ -93,56 +569,70 @@ void Networking::write_uint64s(vector<uint64_t> &values) {
 }
 
 void Networking::read_ciphertexts(vector<Ciphertext> &ciphertexts) {
-    assert(read_uint32() == NET_MAGIC_VECTOR_CIPHERTEXT);
-    uint32_t length = read_uint32();
-    ciphertexts.resize(length);
-    for (size_t i = 0; i < length; i++) {
+    ciphertexts.resize(read_ciphertexts_start());
+    for (size_t i = 0; i < ciphertexts.size(); i++) {
         read_ciphertext(ciphertexts[i]);
     }
 }
 
-void Networking::write_ciphertexts(vector<Ciphertext> &ciphertexts) {
-    write_uint32(NET_MAGIC_VECTOR_CIPHERTEXT);
-    write_uint32(ciphertexts.size());
+size_t Networking::read_ciphertexts_start() {
+    read_magic(NET_MAGIC_VECTOR_CIPHERTEXT);
+    return read_uint32();
+}
+
+void Networking::write_ciphertexts(const vector<Ciphertext> &ciphertexts) {
+    write_ciphertexts_start(ciphertexts.size());
     for (size_t i = 0; i < ciphertexts.size(); i++) {
         write_ciphertext(ciphertexts[i]);
     }
 }
 
-void Networking::read_public_key(PublicKey &public_key) {
-    assert(seal_context);
-    assert(read_uint32() == NET_MAGIC_PUBLIC_KEY);
-    uint32_t length = read_uint32();
-    auto transferred = read(socket, read_buffer, transfer_exactly(length));
-    assert(transferred == length);
-    public_key.load(seal_context, read_stream);
+void Networking::write_ciphertexts_start(size_t count) {
+    write_uint32(NET_MAGIC_VECTOR_CIPHERTEXT);
+    write_uint32(count);
+}
+
+void Networking::read_public_key(PublicKey &public_key, fingerprint_type *key_fingerprint, size_t max_size) {
+    read_magic(NET_MAGIC_PUBLIC_KEY);
+    read_object(public_key, key_fingerprint, max_size);
 }
 
 void Networking::write_public_key(PublicKey &public_key) {
     write_uint32(NET_MAGIC_PUBLIC_KEY);
     public_key.save(write_stream);
-    uint32_t length = write_buffer.size();
-    write_uint32(length);
-    auto transferred = write(socket, write_buffer, transfer_exactly(length));
-    assert(transferred == length);
-    write_buffer.consume(length);
 }
 
-void Networking::read_relin_keys(RelinKeys &relin_keys) {
-    assert(seal_context);
-    assert(read_uint32() == NET_MAGIC_RELIN_KEYS);
-    uint32_t length = read_uint32();
-    auto transferred = read(socket, read_buffer, transfer_exactly(length));
-    assert(transferred == length);
-    relin_keys.load(seal_context, read_stream);
+void Networking::read_relin_keys(RelinKeys &relin_keys, fingerprint_type *key_fingerprint, size_t max_size) {
+    read_magic(NET_MAGIC_RELIN_KEYS);
+    read_object(relin_keys, key_fingerprint, max_size);
 }
 
-void Networking::write_relin_keys(RelinKeys relin_keys) {
+void Networking::write_relin_keys(const RelinKeys &relin_keys) {
     write_uint32(NET_MAGIC_RELIN_KEYS);
     relin_keys.save(write_stream);
-    uint32_t length = write_buffer.size();
-    write_uint32(length);
-    auto transferred = write(socket, write_buffer, transfer_exactly(length));
-    assert(transferred == length);
-    write_buffer.consume(length);
+}
+
+void Networking::read_fingerprint(fingerprint_type &value) {
+    read_magic(NET_MAGIC_FINGERPRINT);
+    for (size_t i = 0; i < value.size(); i++) {
+        value[i] = read_uint64();
+    }
+}
+
+void Networking::write_fingerprint(const fingerprint_type &value) {
+    write_uint32(NET_MAGIC_FINGERPRINT);
+    for (size_t i = 0; i < value.size(); i++) {
+        write_uint64(value[i]);
+    }
+}
+
+uint32_t Networking::read_frame_header(uint32_t &request_id) {
+    uint32_t type = read_uint32();
+    request_id = read_uint32();
+    return type;
+}
+
+void Networking::write_frame_header(uint32_t type, uint32_t request_id) {
+    write_uint32(type);
+    write_uint32(request_id);
 }
@@ -6,15 +6,96 @@
 #include "boost/asio.hpp"
 #include "seal/seal.h"
 
+#include "fingerprint.h"
 #include "psi.h"
+#include "shared_memory.h"
 
 using namespace std;
 using namespace boost::asio;
 
+/* flags in the sender's reply to the fingerprints of the receiver's keys, which
+   say which keys the sender doesn't have cached and needs to be sent. */
+const uint32_t NET_SEND_PUBLIC_KEY = 1;
+const uint32_t NET_SEND_RELIN_KEYS = 2;
+
+/* the sender's decision whether to take on the session, which it sends before
+   the flags above. if it's not NET_STATUS_OK, the sender closes the connection
+   right after it. see AdmissionControl. */
+const uint32_t NET_STATUS_OK = 0;
+const uint32_t NET_STATUS_TOO_EXPENSIVE = 1;
+const uint32_t NET_STATUS_BUSY = 2;
+
+/* after the handshake, the receiver sends any number of query frames, each of
+   which the sender answers with a response frame with the same request id, and
+   finally an end frame, after which the connection is closed. */
+const uint32_t NET_FRAME_QUERY = 0x71757279ul; // 'qury'
+const uint32_t NET_FRAME_RESPONSE = 0x72657370ul; // 'resp'
+const uint32_t NET_FRAME_END = 0x656e6421ul; // 'end!'
+
+/* optional features, which each side advertises in its hello. a feature is only
+   used if both sides support it. */
+const uint32_t NET_FEATURE_PACKED_CIPHERTEXTS = 1;
+const uint32_t NET_FEATURE_SHARED_MEMORY = 2;
+const uint32_t NET_FEATURES_ALL = NET_FEATURE_PACKED_CIPHERTEXTS | NET_FEATURE_SHARED_MEMORY;
+
+/* the size of the ring that each side writes its ciphertexts to, if they share
+   memory. */
+const size_t NET_SHARED_MEMORY_SIZE = 64 << 20;
+
+/*
+Everything that's written is first collected in a buffer, and then sent as one
+message (its length, followed by its contents) with a single gather write when
+flush() is called. On the other side, messages are received with as few reads
+as possible, and then parsed in memory.
+
+Any pending message is flushed before a read has to wait for the socket, so
+flush() only needs to be called explicitly if something must be sent right
+away, e.g. to stream ciphertexts as soon as they're ready, or before closing
+the connection.
+
+Ciphertexts are not copied at all: only a small header is buffered, and the
+gather write points directly at the ciphertext's coefficients, so a ciphertext
+that has been written must not be changed or destroyed until the next flush.
+On the other side, the coefficients are read directly into the ciphertext,
+which is resized to fit them (so reusing ciphertexts avoids reallocating them).
+
+If both sides support NET_FEATURE_PACKED_CIPHERTEXTS, ciphertexts are instead
+bit-packed (see bit_packing.h), which means they are copied into the buffer, but
+makes them 20-50% smaller. Both hellos must have been exchanged before any
+ciphertexts are sent.
+
+Messages go over a TCP socket, or a Unix domain socket if both sides are on the
+same host. Over a Unix domain socket, NET_FEATURE_SHARED_MEMORY is also
+supported: each side passes the other a SharedMemoryRing along with its hello,
+and then writes the coefficients of its ciphertexts straight into it, so that
+only their headers go through the socket. A ciphertext that doesn't fit into
+the ring right now is sent inline, as usual, so writing never waits for the
+other side.
+*/
+
+class Transport;
+
+/* addresses are host:port for TCP, or unix:path for a Unix domain socket. */
+bool is_unix_address(const string &address);
+/* splits a host:port address, or returns the path of a unix:path address. */
+void split_address(const string &address, string &host, string &port);
+string unix_address_path(const string &address);
+
 class Networking
 {
 public:
-    Networking(ip::tcp::socket &socket);
+    /* features are the optional features this side supports. the socket is
+       moved into the Networking, which closes it when it's destroyed. */
+    Networking(ip::tcp::socket socket, uint32_t features = NET_FEATURES_ALL);
+    Networking(local::stream_protocol::socket socket, uint32_t features = NET_FEATURES_ALL);
+    ~Networking();
+
+    /* connects to a host:port or unix:path address. */
+    static unique_ptr<Networking> connect_to(io_context &context,
+                                             const string &address,
+                                             uint32_t features = NET_FEATURES_ALL);
+
+    void flush();
 
     void set_seal_context(shared_ptr<SEALContext> new_context);
 
@@ -24,30 +105,90 @@ public:
     uint64_t read_uint64();
     void write_uint64(uint64_t value);
 
+    /* after reading the other side's hello, only the features that both
+       sides support are enabled. */
     void read_hello();
     void write_hello();
+    bool packs_ciphertexts();
+    bool shares_memory();
+
+    /* the number of bytes write_ciphertext sends for this ciphertext. */
+    static size_t ciphertext_size(shared_ptr<SEALContext> context, const Ciphertext &ciphertext, bool packed);
 
-    void read_uint64s(vector<uint64_t> &values);
+    /* throws invalid_argument if the other side sends more than max_length
+       values. */
+    void read_uint64s(vector<uint64_t> &values, size_t max_length = UINT32_MAX);
     void write_uint64s(vector<uint64_t> &values);
 
     void read_ciphertext(Ciphertext &ciphertext);
-    void write_ciphertext(Ciphertext &ciphertext);
+    void write_ciphertext(const Ciphertext &ciphertext);
 
     void read_ciphertexts(vector<Ciphertext> &ciphertexts);
-    void write_ciphertexts(vector<Ciphertext> &ciphertexts);
-
-    void read_public_key(PublicKey &public_key);
+    /* read_ciphertexts is equivalent to read_ciphertexts_start, which returns
+       the number of ciphertexts, followed by read_ciphertext for each of them,
+       so ciphertexts can also be processed one by one, as they arrive. */
+    size_t read_ciphertexts_start();
+    void write_ciphertexts(const vector<Ciphertext> &ciphertexts);
+    /* write_ciphertexts is equivalent to write_ciphertexts_start followed by
+       write_ciphertext for every element, so ciphertexts can also be sent one
+       by one, as soon as each of them is ready. */
+    void write_ciphertexts_start(size_t count);
+
+    /* if key_fingerprint is given, it is set to the fingerprint of the key as
+       it was received. a key is only buffered if its message is at most
+       max_size bytes long, and invalid_argument is thrown otherwise. */
+    void read_public_key(PublicKey &public_key,
+                         fingerprint_type *key_fingerprint = nullptr,
+                         size_t max_size = SIZE_MAX);
     void write_public_key(PublicKey &public_key);
 
-    void read_relin_keys(RelinKeys &relin_keys);
-    void write_relin_keys(RelinKeys relin_keys);
+    void read_relin_keys(RelinKeys &relin_keys,
+                         fingerprint_type *key_fingerprint = nullptr,
+                         size_t max_size = SIZE_MAX);
+    void write_relin_keys(const RelinKeys &relin_keys);
+
+    void read_fingerprint(fingerprint_type &value);
+    void write_fingerprint(const fingerprint_type &value);
+
+    /* returns the frame's type. */
+    uint32_t read_frame_header(uint32_t &request_id);
+    void write_frame_header(uint32_t type, uint32_t request_id);
 
 private:
-    ip::tcp::socket &socket;
+    /* reads the magic number that starts a value, and throws invalid_argument
+       if it's not the expected one. */
+    void read_magic(uint32_t magic);
+    /* makes sure that the current message has something left to read. */
+    void start_reading();
+    /* makes sure that at least byte_count bytes are in the read buffer. */
+    void receive(size_t byte_count);
+    void read_bytes(void *destination, size_t byte_count);
+    /* like read_bytes, but whatever hasn't been received yet is read directly
+       into the destination, without going through the read buffer. */
+    void read_bytes_direct(void *destination, size_t byte_count);
+    /* adds byte_count bytes at data to the message without copying them. */
+    void write_bytes_external(const void *data, size_t byte_count);
+    /* loads a SEAL object from the current message, which must not have more
+       than max_size bytes left, and optionally computes the fingerprint of its
+       serialization. */
+    template <typename T>
+    void read_object(T &object, fingerprint_type *object_fingerprint, size_t max_size);
+
+    unique_ptr<Transport> transport;
     boost::asio::streambuf read_buffer;
     std::istream read_stream;
+    // the number of bytes of the current message that haven't been read yet.
+    size_t message_remaining;
     boost::asio::streambuf write_buffer;
     std::ostream write_stream;
+    // the external parts of the message, each with the number of buffered
+    // bytes that precede it.
+    vector<pair<size_t, const_buffer>> write_external;
+    size_t write_external_size;
 
     shared_ptr<SEALContext> seal_context;
+    uint32_t features;
+    // our ring, and the other side's, if we share memory.
+    unique_ptr<SharedMemoryRing> write_ring;
+    unique_ptr<SharedMemoryRing> read_ring;
 };
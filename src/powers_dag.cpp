@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "powers_dag.h"
+
+// when looking for a basis, the greedy step only tries this many candidates for
+// each new element, and the exhaustive search gives up after visiting this many
+// partial bases.
+const size_t BASIS_GREEDY_CANDIDATES = 64;
+const size_t BASIS_SEARCH_BUDGET = 1 << 16;
+
+PowersDag::PowersDag()
+    : max_power_(0)
+{}
+
+PowersDag::PowersDag(vector<uint64_t> &sources, size_t max_power)
+    : max_power_(max_power),
+      is_source_(max_power + 1, false),
+      depth_(max_power + 1, 0),
+      factors_(max_power + 1, make_pair(0, 0)),
+      dependents_(max_power + 1)
+{
+    for (uint64_t s : sources) {
+        assert(s > 0);
+        if (s <= max_power) {
+            is_source_[s] = true;
+        }
+    }
+    assert((max_power == 0) || is_source_[1]);
+
+    // counts[n] is k(n), and last[n] is one of the sources in an optimal
+    // decomposition of n, so that the whole decomposition can be recovered by
+    // following last[n], last[n - last[n]], etc.
+    vector<size_t> counts(max_power + 1, SIZE_MAX);
+    vector<size_t> last(max_power + 1, 0);
+    counts[0] = 0;
+    for (size_t n = 1; n <= max_power; n++) {
+        for (uint64_t s : sources) {
+            if ((s <= n) && (counts[n - s] != SIZE_MAX) && (counts[n - s] + 1 < counts[n])) {
+                counts[n] = counts[n - s] + 1;
+                last[n] = s;
+            }
+        }
+    }
+
+    vector<size_t> decomposition;
+    for (size_t n = 1; n <= max_power; n++) {
+        if (is_source_[n]) {
+            continue;
+        }
+
+        decomposition.clear();
+        for (size_t rest = n; rest > 0; rest -= last[rest]) {
+            decomposition.push_back(last[rest]);
+        }
+        assert(decomposition.size() == counts[n]);
+
+        size_t a = 0;
+        for (size_t i = 0; i < (decomposition.size() + 1) / 2; i++) {
+            a += decomposition[i];
+        }
+        size_t b = n - a;
+        if (a < b) {
+            swap(a, b);
+        }
+
+        factors_[n] = make_pair(a, b);
+        depth_[n] = max(depth_[a], depth_[b]) + 1;
+        dependents_[a].push_back(n);
+        if (b != a) {
+            dependents_[b].push_back(n);
+        }
+    }
+}
+
+size_t PowersDag::max_power()
+{
+    return max_power_;
+}
+
+size_t PowersDag::depth()
+{
+    size_t result = 0;
+    for (size_t d : depth_) {
+        result = max(result, d);
+    }
+    return result;
+}
+
+size_t PowersDag::multiplication_count()
+{
+    size_t result = 0;
+    for (size_t n = 1; n <= max_power_; n++) {
+        if (!is_source_[n]) {
+            result++;
+        }
+    }
+    return result;
+}
+
+bool PowersDag::is_source(size_t power)
+{
+    assert(power <= max_power_);
+    return is_source_[power];
+}
+
+size_t PowersDag::depth(size_t power)
+{
+    assert(power <= max_power_);
+    return depth_[power];
+}
+
+pair<size_t, size_t> PowersDag::factors(size_t power)
+{
+    assert((power <= max_power_) && !is_source_[power]);
+    return factors_[power];
+}
+
+vector<size_t> &PowersDag::dependents(size_t power)
+{
+    assert(power <= max_power_);
+    return dependents_[power];
+}
+
+
+// returns the largest r such that every 1 <= n <= r is a sum of at most h
+// elements of basis (but at most limit).
+size_t stamp_reach(vector<uint64_t> &basis, size_t h, size_t limit)
+{
+    vector<size_t> counts(1, 0);
+    for (size_t n = 1; n <= limit; n++) {
+        size_t count = SIZE_MAX;
+        for (uint64_t s : basis) {
+            if ((s <= n) && (counts[n - s] < count)) {
+                count = counts[n - s] + 1;
+            }
+        }
+        if (count > h) {
+            return n - 1;
+        }
+        counts.push_back(count);
+    }
+    return limit;
+}
+
+// depth-first search for a basis with exactly size elements which extends
+// basis. every new element must be at most reach + 1, since otherwise reach + 1
+// could never be covered.
+bool search_power_basis(vector<uint64_t> &basis, size_t size, size_t h, size_t max_power, size_t &budget)
+{
+    if (budget == 0) {
+        return false;
+    }
+    budget--;
+
+    size_t reach = stamp_reach(basis, h, max_power);
+    if (reach >= max_power) {
+        return true;
+    }
+    if (basis.size() == size) {
+        return false;
+    }
+
+    for (uint64_t x = reach + 1; x > basis.back(); x--) {
+        basis.push_back(x);
+        if (search_power_basis(basis, size, h, max_power, budget)) {
+            return true;
+        }
+        basis.pop_back();
+    }
+    return false;
+}
+
+vector<uint64_t> plan_power_basis(size_t max_power, size_t depth)
+{
+    vector<uint64_t> basis = {1};
+    if ((max_power <= 1) || (depth >= 64)) {
+        return basis;
+    }
+    size_t h = (1ull << depth);
+
+    // greedy: repeatedly add the element that covers the longest prefix.
+    size_t reach = stamp_reach(basis, h, max_power);
+    while (reach < max_power) {
+        uint64_t first = basis.back() + 1;
+        uint64_t candidate_count = reach + 1 - basis.back();
+        uint64_t step = max<uint64_t>(1, candidate_count / BASIS_GREEDY_CANDIDATES);
+
+        uint64_t best = reach + 1;
+        size_t best_reach = 0;
+        // candidates are tried from the largest down, so that ties go to the
+        // largest candidate.
+        for (uint64_t x = reach + 1; x >= first; x -= min(step, x - first)) {
+            basis.push_back(x);
+            size_t new_reach = stamp_reach(basis, h, max_power);
+            basis.pop_back();
+            if (new_reach > best_reach) {
+                best = x;
+                best_reach = new_reach;
+            }
+            if (x == first) {
+                break;
+            }
+        }
+
+        basis.push_back(best);
+        reach = best_reach;
+    }
+
+    // exhaustive search for smaller bases, until we either fail or run out of
+    // time. a set of k elements has at most binomial(k + h, h) - 1 nonzero sums
+    // of at most h elements, which bounds how small the basis can get.
+    while (basis.size() > 1) {
+        size_t size = basis.size() - 1;
+        uint64_t sums = 1;
+        for (size_t i = 1; (i <= size) && (sums <= max_power); i++) {
+            sums = sums * (h + i) / i;
+        }
+        if (sums - 1 < max_power) {
+            break;
+        }
+
+        vector<uint64_t> candidate = {1};
+        size_t budget = BASIS_SEARCH_BUDGET;
+        if (!search_power_basis(candidate, size, h, max_power, budget)) {
+            break;
+        }
+        basis = candidate;
+    }
+
+    sort(basis.begin(), basis.end());
+    return basis;
+}
+
+bool valid_power_basis(const vector<uint64_t> &sources, size_t max_power)
+{
+    if (sources.empty() || (sources[0] != 1) || (sources.back() > max_power)) {
+        return false;
+    }
+    for (size_t i = 1; i < sources.size(); i++) {
+        if (sources[i] <= sources[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/*
+A PowersDag is a plan for computing all powers y^1, y^2, ..., y^m of some y,
+given only y^s for each s in a set S of *source* powers, where every non-source
+power is computed as the product of two previously computed powers.
+
+Since every non-source power costs exactly one multiplication, the number of
+multiplications is always m - |S ∩ [1, m]|, which is optimal. What the plan
+optimizes is the multiplicative depth of each power, i.e. the length of the
+longest chain of multiplications that it depends on.
+
+If k(n) is the smallest number of (not necessarily distinct) sources that add up
+to n, then no plan can compute y^n with depth less than ceil(log2(k(n))),
+because a product tree of depth d has at most 2^d leaves. Conversely, splitting
+those k(n) sources into two halves of sizes ceil(k(n) / 2) and floor(k(n) / 2)
+gives n = a + b with both k(a) and k(b) at most ceil(k(n) / 2), so by induction
+every power is computed with exactly that optimal depth. k(n) is found with the
+usual coin change dynamic program in O(m * |S|) time.
+
+Sources larger than m are ignored. 1 must be a source.
+*/
+
+class PowersDag
+{
+public:
+    PowersDag();
+    PowersDag(vector<uint64_t> &sources, size_t max_power);
+
+    size_t max_power();
+    /* the maximum depth of any power. */
+    size_t depth();
+    size_t multiplication_count();
+
+    bool is_source(size_t power);
+    size_t depth(size_t power);
+    /* for a non-source power n, returns (a, b) with a >= b and a + b = n. */
+    pair<size_t, size_t> factors(size_t power);
+    /* all powers whose factors include the given power. */
+    vector<size_t> &dependents(size_t power);
+
+private:
+    size_t max_power_;
+    vector<bool> is_source_;
+    vector<size_t> depth_;
+    vector<pair<size_t, size_t>> factors_;
+    vector<vector<size_t>> dependents_;
+};
+
+
+/*
+plan_power_basis looks for a small set S of source powers such that every power
+y^n with n <= max_power can be computed from S with multiplicative depth at most
+`depth`, i.e. such that every such n is a sum of at most h = 2^depth elements of
+S. This is the extremal postage stamp problem (S is a set of stamp values, and
+at most h stamps fit on an envelope), so there is a continuum of trade-offs:
+depth = 0 makes S = {1, ..., max_power}, and large depths make S = {1}.
+
+A greedy basis is computed first, and then a bounded exhaustive search tries to
+find smaller ones. The result always contains 1 and is sorted.
+*/
+vector<uint64_t> plan_power_basis(size_t max_power, size_t depth);
+
+/* whether sources is a power basis that a PowersDag for max_power can be built
+   from without wasting any source: strictly increasing, starting at 1, and
+   with no source above max_power (so there are at most max_power of them). */
+bool valid_power_basis(const vector<uint64_t> &sources, size_t max_power);
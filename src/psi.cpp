@@ -1,9 +1,13 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <utility>
 
 #include "seal/seal.h"
 
+#include "bitmap.h"
 #include "hashing.h"
+#include "memory_pools.h"
 #include "polynomials.h"
 #include "random.h"
 #include "windowing.h"
@@ -22,17 +26,19 @@ void multiply_by_random_mask(Ciphertext &ciphertext,
                              shared_ptr<UniformRandomGenerator> random,
                              BatchEncoder &encoder,
                              Evaluator &evaluator,
-                             RelinKeys &relin_keys,
                              uint64_t plain_modulus)
 {
     size_t slot_count = encoder.slot_count();
-    Plaintext mask(slot_count, slot_count);
+    // every thread reuses its mask.
+    thread_local Plaintext mask(thread_memory_pool());
+    mask.resize(slot_count);
     for (size_t j = 0; j < slot_count; j++) {
         mask[j] = random_nonzero_integer(random, plain_modulus);
     }
-    encoder.encode(mask);
-    evaluator.multiply_plain_inplace(ciphertext, mask);
-    evaluator.relinearize_inplace(ciphertext, relin_keys);
+    encoder.encode(mask, thread_memory_pool());
+    // multiply_plain does not increase the size of the ciphertext, so there is
+    // no need to relinearize afterwards.
+    evaluator.multiply_plain_inplace(ciphertext, mask, thread_memory_pool());
 }
 
 
@@ -158,10 +164,27 @@ size_t PSIParams::sender_partition_count() {
     return sender_partition_count_;
 }
 
+size_t PSIParams::max_partition_size() {
+    size_t partition_count = sender_partition_count();
+    return (sender_bucket_capacity() + (partition_count - 1)) / partition_count;
+}
+
+bool PSIParams::needs_relin_keys() {
+    return windowing().dag().multiplication_count() > 0;
+}
+
 size_t PSIParams::window_size() {
     return window_size_;
 }
 
+size_t PSIParams::poly_modulus_degree() {
+    return poly_modulus_degree_;
+}
+
+vector<uint64_t> &PSIParams::power_basis() {
+    return power_basis_;
+}
+
 void PSIParams::set_sender_partition_count(size_t new_value) {
     sender_partition_count_ = new_value;
 }
@@ -170,6 +193,54 @@ void PSIParams::set_window_size(size_t new_value) {
     window_size_ = new_value;
 }
 
+void PSIParams::set_power_basis(vector<uint64_t> new_value) {
+    power_basis_ = new_value;
+}
+
+size_t PSIParams::label_chunk_bits() {
+    // every chunk must be less than the plain modulus.
+    uint64_t modulus = plain_modulus();
+    size_t bits = 0;
+    while ((2ull << bits) <= modulus) {
+        bits++;
+    }
+    return bits;
+}
+
+vector<size_t> PSIParams::label_column_bits() {
+    if (label_column_bits_.empty()) {
+        return {label_chunk_bits()};
+    }
+    return label_column_bits_;
+}
+
+void PSIParams::set_label_column_bits(vector<size_t> new_value) {
+    for (size_t bits : new_value) {
+        assert((bits > 0) && (bits <= 64));
+    }
+    label_column_bits_ = new_value;
+}
+
+vector<pair<size_t, size_t>> PSIParams::label_chunks() {
+    vector<pair<size_t, size_t>> chunks;
+    vector<size_t> column_bits = label_column_bits();
+    size_t chunk_bits = label_chunk_bits();
+    for (size_t column = 0; column < column_bits.size(); column++) {
+        for (size_t offset = 0; offset < column_bits[column]; offset += chunk_bits) {
+            chunks.emplace_back(column, offset);
+        }
+    }
+    return chunks;
+}
+
+Windowing PSIParams::windowing() {
+    if (power_basis_.empty()) {
+        return Windowing(window_size(), max_partition_size());
+    } else {
+        return Windowing(power_basis_, max_partition_size());
+    }
+}
+
 
 uint64_t PSIParams::encode_bucket_element(vector<uint64_t> &inputs, bucket_slot &element, bool is_receiver) {
     uint64_t result;
@@ -193,20 +264,72 @@ uint64_t PSIParams::encode_bucket_element(vector<uint64_t> &inputs, bucket_slot
 }
 
 
-PSIReceiver::PSIReceiver(PSIParams &params)
+PSIReceiver::PSIReceiver(PSIParams &params, size_t thread_count, KeyStore *key_store)
     : params(params),
-      keygen(params.context),
-      public_key_(keygen.public_key()),
-      secret_key(keygen.secret_key())
+      key_store(key_store),
+      pool(thread_count)
 {
+    optional<ReceiverKeys> stored_keys;
+    if (key_store != nullptr) {
+        stored_keys = key_store->load(params.context);
+    }
+
+    if (stored_keys.has_value()) {
+        keygen = make_unique<KeyGenerator>(params.context, stored_keys->secret_key, stored_keys->public_key);
+    } else {
+        keygen = make_unique<KeyGenerator>(params.context);
+    }
+    public_key_ = keygen->public_key();
+    secret_key = keygen->secret_key();
+    if (stored_keys.has_value()) {
+        public_key_fingerprint_ = stored_keys->public_key_fingerprint;
+    } else {
+        public_key_fingerprint_ = fingerprint(public_key_);
+    }
+
 #ifdef DEBUG_WITH_KEY_LEAK
     receiver_key_leaked = &secret_key;
 #endif
+
+    if (params.needs_relin_keys()) {
+        if (stored_keys.has_value() && stored_keys->relin_keys.has_value()) {
+            promise<RelinKeys> stored_relin_keys;
+            relin_keys_fingerprint_ = stored_keys->relin_keys_fingerprint;
+            stored_relin_keys.set_value(move(stored_keys->relin_keys.value()));
+            relin_keys_ = stored_relin_keys.get_future().share();
+        } else {
+            // the keys are saved once the relin keys are ready.
+            start_relin_keys();
+        }
+    } else if ((key_store != nullptr) && !stored_keys.has_value()) {
+        key_store->save(params.context, secret_key, public_key_);
+    }
 }
 
-vector<Ciphertext> PSIReceiver::encrypt_inputs(vector<uint64_t> &inputs, vector<bucket_slot> &buckets)
+void PSIReceiver::start_relin_keys()
 {
-    assert(inputs.size() == params.receiver_size);
+    // packaged_task can't be copied, but ThreadPool wants a copyable function.
+    auto task = make_shared<packaged_task<RelinKeys()>>([this] {
+        RelinKeys result = keygen->relin_keys(RELIN_KEYS_DECOMPOSITION_BIT_COUNT);
+        // this happens before the future is ready, so whoever waits for the
+        // keys can also read their fingerprint.
+        relin_keys_fingerprint_ = fingerprint(result);
+        if (key_store != nullptr) {
+            key_store->save(params.context, secret_key, public_key_, &result);
+        }
+        return result;
+    });
+    relin_keys_ = task->get_future().share();
+    pool.submit([task] { (*task)(); });
+}
+
+vector<Ciphertext> PSIReceiver::encrypt_inputs(vector<uint64_t> &inputs,
+                                               vector<bucket_slot> &buckets,
+                                               function<void(size_t, Ciphertext &)> on_window_ready)
+{
+    // queries may be smaller than the receiver set size the params were
+    // chosen for, but not larger.
+    assert(inputs.size() <= params.receiver_size);
 
     Encryptor encryptor(params.context, public_key_);
     BatchEncoder encoder(params.context);
@@ -222,72 +345,213 @@ vector<Ciphertext> PSIReceiver::encrypt_inputs(vector<uint64_t> &inputs, vector<
     assert(res); // TODO: handle gracefully
 
     vector<uint64_t> buckets_enc(bucket_count);
-    size_t partition_count = params.sender_partition_count();
-    size_t max_partition_size = (params.sender_bucket_capacity() + (partition_count - 1)) / partition_count;
-    Windowing windowing(params.window_size(), max_partition_size);
+    Windowing windowing = params.windowing();
 
     for (size_t i = 0; i < bucket_count; i++) {
         buckets_enc[i] = params.encode_bucket_element(inputs, buckets[i], true);
     }
 
     vector<Ciphertext> result;
-    windowing.prepare(buckets_enc, result, plain_modulus, encoder, encryptor);
+    windowing.prepare(buckets_enc, result, plain_modulus, encoder, encryptor, zero_pool.get(), pool, on_window_ready);
 
     return result;
 }
 
 vector<size_t> PSIReceiver::decrypt_matches(vector<Ciphertext> &encrypted_matches)
 {
-    Decryptor decryptor(params.context, secret_key);
-    BatchEncoder encoder(params.context);
-    size_t slot_count = encoder.slot_count();
+    vector<size_t> result;
+    vector<uint64_t> labels;
+    decrypt_response(encrypted_matches, result, labels);
+    return result;
+}
 
-    size_t bucket_count = (1 << params.bucket_count_log());
+vector<pair<size_t, uint64_t>> PSIReceiver::decrypt_labeled_matches(vector<Ciphertext> &encrypted_matches)
+{
+    assert(params.label_chunks().size() == 1);
+    assert(encrypted_matches.size() == 2 * params.sender_partition_count());
 
-    vector<size_t> result;
+    vector<size_t> match_buckets;
+    vector<uint64_t> labels;
+    decrypt_response(encrypted_matches, match_buckets, labels);
 
-    Plaintext decrypted;
-    for (size_t i = 0; i < encrypted_matches.size(); i++) {
-        decryptor.decrypt(encrypted_matches[i], decrypted);
-        encoder.decode(decrypted);
+    vector<pair<size_t, uint64_t>> result(match_buckets.size());
+    for (size_t i = 0; i < match_buckets.size(); i++) {
+        result[i] = pair<size_t, uint64_t>(match_buckets[i], labels[i]);
+    }
+    return result;
+}
+
+vector<pair<size_t, vector<uint64_t>>> PSIReceiver::decrypt_label_columns(vector<Ciphertext> &encrypted_matches)
+{
+    size_t column_count = params.label_column_bits().size();
+    assert(encrypted_matches.size() == (1 + params.label_chunks().size()) * params.sender_partition_count());
+
+    vector<size_t> match_buckets;
+    vector<uint64_t> labels;
+    decrypt_response(encrypted_matches, match_buckets, labels);
+
+    vector<pair<size_t, vector<uint64_t>>> result(match_buckets.size());
+    for (size_t i = 0; i < match_buckets.size(); i++) {
+        result[i].first = match_buckets[i];
+        result[i].second.assign(&labels[i * column_count], &labels[(i + 1) * column_count]);
+    }
+    return result;
+}
+
+void PSIReceiver::decrypt_input_matches(vector<Ciphertext> &encrypted_matches,
+                                        vector<bucket_slot> &buckets,
+                                        InputMatches &result)
+{
+    bool labeled = (encrypted_matches.size() != params.sender_partition_count());
+    result.label_count = labeled ? params.label_column_bits().size() : 0;
+    decrypt_response(encrypted_matches, result.inputs, result.labels);
+
+    // the matches are found as buckets, which are replaced by their inputs.
+    for (size_t &match : result.inputs) {
+        assert(buckets[match] != BUCKET_EMPTY);
+        match = buckets[match].first;
+    }
+}
 
-        for (size_t j = 0; j < bucket_count; j++) {
-            if (decrypted[j] == 0) {
-                result.push_back(j);
+void PSIReceiver::decrypt_response(vector<Ciphertext> &encrypted_matches,
+                                   vector<size_t> &match_buckets,
+                                   vector<uint64_t> &labels)
+{
+    size_t partition_count = params.sender_partition_count();
+    assert(encrypted_matches.size() % partition_count == 0);
+    size_t results_per_partition = encrypted_matches.size() / partition_count;
+    bool labeled = (results_per_partition > 1);
+    vector<pair<size_t, size_t>> chunks;
+    size_t column_count = 0;
+    if (labeled) {
+        chunks = params.label_chunks();
+        column_count = params.label_column_bits().size();
+        assert(results_per_partition == 1 + chunks.size());
+    }
+
+    size_t bucket_count = (1 << params.bucket_count_log());
+    size_t words = bitmap_words(bucket_count);
+    vector<uint64_t> bitmaps(partition_count * words);
+    vector<size_t> match_counts(partition_count);
+
+    // first, every partition's matches are found, all partitions at once...
+    parallel_for(pool, partition_count, [&](size_t partition) {
+        Decryptor decryptor(params.context, secret_key);
+        BatchEncoder encoder(params.context);
+
+        // every thread reuses its buffer for the decrypted partitions.
+        thread_local Plaintext decrypted(thread_memory_pool());
+        decryptor.decrypt(encrypted_matches[results_per_partition * partition], decrypted);
+        encoder.decode(decrypted, thread_memory_pool());
+        match_counts[partition] = zero_bitmap(decrypted.data(), bucket_count, &bitmaps[partition * words]);
+    });
+
+    // ...then they're given their places in the result...
+    vector<size_t> first_match(partition_count);
+    size_t match_count = 0;
+    for (size_t partition = 0; partition < partition_count; partition++) {
+        first_match[partition] = match_count;
+        match_count += match_counts[partition];
+    }
+    match_buckets.resize(match_count);
+    labels.assign(match_count * column_count, 0);
+
+    // ...and filled in. most partitions have no matches at all, and then their
+    // labels don't need to be decrypted.
+    parallel_for(pool, partition_count, [&](size_t partition) {
+        if (match_counts[partition] == 0) {
+            return;
+        }
+        size_t *partition_buckets = &match_buckets[first_match[partition]];
+        size_t i = 0;
+        for_each_set_bit(&bitmaps[partition * words], words, [&](size_t bucket) {
+            partition_buckets[i++] = bucket;
+        });
+        if (!labeled) {
+            return;
+        }
+
+        Decryptor decryptor(params.context, secret_key);
+        BatchEncoder encoder(params.context);
+
+        // every chunk is put back into its place in its column.
+        uint64_t *partition_labels = &labels[first_match[partition] * column_count];
+        thread_local Plaintext decrypted(thread_memory_pool());
+        for (size_t c = 0; c < chunks.size(); c++) {
+            decryptor.decrypt(encrypted_matches[results_per_partition * partition + 1 + c], decrypted);
+            encoder.decode(decrypted, thread_memory_pool());
+            const uint64_t *slots = decrypted.data();
+            for (size_t k = 0; k < match_counts[partition]; k++) {
+                partition_labels[k * column_count + chunks[c].first] |= slots[partition_buckets[k]] << chunks[c].second;
             }
         }
-    }
+    });
+}
 
-    return result;
+void PSIReceiver::decrypt_partition_matches(Ciphertext &encrypted_matches, vector<size_t> &result)
+{
+    Decryptor decryptor(params.context, secret_key);
+    BatchEncoder encoder(params.context);
+
+    size_t bucket_count = (1 << params.bucket_count_log());
+
+    Plaintext decrypted;
+    decryptor.decrypt(encrypted_matches, decrypted);
+    encoder.decode(decrypted);
+
+    vector<uint64_t> bitmap(bitmap_words(bucket_count));
+    zero_bitmap(decrypted.data(), bucket_count, bitmap.data());
+    for_each_set_bit(bitmap.data(), bitmap.size(), [&](size_t bucket) {
+        result.push_back(bucket);
+    });
 }
 
-vector<pair<size_t, uint64_t>> PSIReceiver::decrypt_labeled_matches(vector<Ciphertext> &encrypted_matches)
+void PSIReceiver::decrypt_partition_labeled_matches(Ciphertext &encrypted_matches,
+                                                    Ciphertext &encrypted_labels,
+                                                    vector<pair<size_t, uint64_t>> &result)
 {
-    assert(encrypted_matches.size() % 2 == 0);
+    assert(params.label_chunks().size() == 1);
+    vector<pair<size_t, vector<uint64_t>>> matches;
+    decrypt_partition_label_columns(encrypted_matches, &encrypted_labels, matches);
+    for (auto &match : matches) {
+        result.push_back(pair<size_t, uint64_t>(match.first, match.second[0]));
+    }
+}
 
+void PSIReceiver::decrypt_partition_label_columns(Ciphertext &encrypted_matches,
+                                                  Ciphertext *encrypted_labels,
+                                                  vector<pair<size_t, vector<uint64_t>>> &result)
+{
     Decryptor decryptor(params.context, secret_key);
     BatchEncoder encoder(params.context);
-    size_t slot_count = encoder.slot_count();
 
     size_t bucket_count = (1 << params.bucket_count_log());
 
-    vector<pair<size_t, uint64_t>> result;
+    Plaintext decrypted_matches;
+    decryptor.decrypt(encrypted_matches, decrypted_matches);
+    encoder.decode(decrypted_matches);
 
-    Plaintext decrypted_matches, decrypted_labels;
-    for (size_t i = 0; i < encrypted_matches.size() / 2; i++) {
-        decryptor.decrypt(encrypted_matches[2*i], decrypted_matches);
-        encoder.decode(decrypted_matches);
-        decryptor.decrypt(encrypted_matches[2*i+1], decrypted_labels);
+    // most partitions have no matches at all, and then the labels don't need
+    // to be decrypted.
+    vector<uint64_t> bitmap(bitmap_words(bucket_count));
+    if (zero_bitmap(decrypted_matches.data(), bucket_count, bitmap.data()) == 0) {
+        return;
+    }
+    size_t first_match = result.size();
+    for_each_set_bit(bitmap.data(), bitmap.size(), [&](size_t bucket) {
+        result.emplace_back(bucket, vector<uint64_t>(params.label_column_bits().size(), 0));
+    });
+
+    // every chunk is put back into its place in its column.
+    vector<pair<size_t, size_t>> chunks = params.label_chunks();
+    Plaintext decrypted_labels;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        decryptor.decrypt(encrypted_labels[c], decrypted_labels);
         encoder.decode(decrypted_labels);
-
-        for (size_t j = 0; j < bucket_count; j++) {
-            if (decrypted_matches[j] == 0) {
-                result.push_back(pair<size_t, uint64_t>(j, decrypted_labels[j]));
-            }
+        for (size_t i = first_match; i < result.size(); i++) {
+            result[i].second[chunks[c].first] |= decrypted_labels[result[i].first] << chunks[c].second;
         }
     }
-
-    return result;
 }
 
 PublicKey& PSIReceiver::public_key()
@@ -295,74 +559,96 @@ PublicKey& PSIReceiver::public_key()
     return public_key_;
 }
 
-RelinKeys PSIReceiver::relin_keys()
+const RelinKeys &PSIReceiver::relin_keys()
 {
-    return keygen.relin_keys(8);
+    if (!relin_keys_.valid()) {
+        start_relin_keys();
+    }
+    return relin_keys_.get();
 }
 
-PSISender::PSISender(PSIParams &params)
-    : params(params)
-{}
+bool PSIReceiver::relin_keys_ready()
+{
+    return relin_keys_.valid() && (relin_keys_.wait_for(chrono::seconds(0)) == future_status::ready);
+}
 
-vector<Ciphertext> PSISender::compute_matches(vector<uint64_t> &inputs,
-                                              optional<vector<uint64_t>> &labels,
-                                              PublicKey& receiver_public_key,
-                                              RelinKeys relin_keys,
-                                              vector<Ciphertext> &receiver_inputs)
+const fingerprint_type &PSIReceiver::public_key_fingerprint()
 {
-    assert(inputs.size() == params.sender_size);
-    assert(!labels.has_value() || (labels.value().size() == inputs.size()));
+    return public_key_fingerprint_;
+}
 
-    auto random_factory = UniformRandomGeneratorFactory::default_factory();
-    auto random = random_factory->create();
+const fingerprint_type &PSIReceiver::relin_keys_fingerprint()
+{
+    relin_keys();
+    return relin_keys_fingerprint_;
+}
 
-    uint64_t plain_modulus = params.plain_modulus();
+ZeroPool &PSIReceiver::enable_zero_pool(size_t capacity, string path)
+{
+    // the old pool (if any) has to save its zeros before the new one loads.
+    zero_pool.reset();
+    zero_pool = make_unique<ZeroPool>(params.context, public_key_, capacity, path);
+    return *zero_pool;
+}
+
+SenderDatabase::SenderDatabase(PSIParams &params,
+                               vector<uint64_t> &inputs,
+                               optional<vector<vector<uint64_t>>> &label_columns,
+                               ThreadPool &pool,
+                               shared_ptr<UniformRandomGenerator> random,
+                               size_t first_partition,
+                               size_t partition_count,
+                               const DatabaseStorage &storage)
+    : first_partition(first_partition),
+      partition_count(partition_count),
+      parms_id(params.context->first_parms_id()),
+      sender_size(params.sender_size),
+      input_bits(params.input_bits),
+      total_partition_count(params.sender_partition_count()),
+      seeds(params.seeds),
+      label_column_bits(params.label_column_bits())
+{
+    if (partition_count == 0) {
+        this->partition_count = total_partition_count - first_partition;
+    }
+    assert(first_partition + this->partition_count <= total_partition_count);
+
+    assert(inputs.size() == params.sender_size);
+    labeled = label_columns.has_value();
+    if (labeled) {
+        assert(label_columns.value().size() == label_column_bits.size());
+        for (size_t c = 0; c < label_column_bits.size(); c++) {
+            auto &column = label_columns.value()[c];
+            assert(column.size() == inputs.size());
+            for (uint64_t label : column) {
+                assert((label_column_bits[c] == 64) || (label >> label_column_bits[c] == 0));
+            }
+        }
+    }
 
-    Encryptor encryptor(params.context, receiver_public_key);
     BatchEncoder encoder(params.context);
-    Evaluator evaluator(params.context);
+    if (!random) {
+        random = UniformRandomGeneratorFactory::default_factory()->create();
+    }
+
+    uint64_t plain_modulus = params.plain_modulus();
+    vector<pair<size_t, size_t>> chunks = params.label_chunks();
+    uint64_t chunk_mask = (1ull << params.label_chunk_bits()) - 1;
 
-    // hash all of the sender's inputs, using every possible hash function, into
-    // a (capacity × bucket_count) hash table.
     size_t bucket_count_log = params.bucket_count_log();
     size_t bucket_count = (1 << bucket_count_log);
     size_t capacity = params.sender_bucket_capacity();
-    vector<bucket_slot> buckets;
-    bool res = complete_hash(random, inputs, bucket_count_log, capacity, buckets, params.seeds);
-    assert(res); // TODO: handle gracefully
 
     // we will split the hash table into partitions: instead of looking at a
     // hash table with `capacity` rows, split it into `partition_count` tables
     // with roughly the same number of rows each.
     // specifically, `big_partition_count` subtables will have
     // `max_partition_size` rows, and the rest will have one fewer.
-    size_t partition_count = params.sender_partition_count();
-    assert(capacity >= partition_count);
-    size_t max_partition_size = (capacity + (partition_count - 1)) / partition_count;
-    size_t big_partition_count = capacity - (max_partition_size - 1) * partition_count;
-
-    Windowing windowing(params.window_size(), max_partition_size);
-
-    // if we're doing labeled PSI, we need two ciphertexts per partition:
-    // one for f(x) and one for r*f(x) + g(x)
-    vector<Ciphertext> result((labels.has_value() ? 2 : 1) * partition_count);
-
-    // compute all the powers of the receiver's input.
-    vector<Ciphertext> powers(max_partition_size + 1);
-    windowing.compute_powers(receiver_inputs, powers, evaluator, relin_keys);
-
-    // we'll need these vectors for each iteration, so let's declare them here
-    // to avoid reallocating them anew each time.
-    vector<uint64_t> current_bucket(max_partition_size);
-    vector<vector<uint64_t>> f_coeffs(bucket_count);
-    // we'll only need these if we're doing labeled PSI, so we set the sizes to
-    // 0 if we aren't to avoid unnecessarily wasting memory
-    vector<uint64_t> current_labels(labels.has_value() ? max_partition_size : 0);
-    vector<vector<uint64_t>> g_coeffs(labels.has_value() ? bucket_count : 0);
-
-    for (size_t partition = 0; partition < partition_count; partition++) {
-        // figure out which many rows go into this partition
-        size_t partition_size, partition_start;
+    assert(capacity >= total_partition_count);
+    size_t max_partition_size = params.max_partition_size();
+    size_t big_partition_count = capacity - (max_partition_size - 1) * total_partition_count;
+    // figure out which many rows go into each partition
+    auto partition_rows = [&](size_t partition, size_t &partition_size, size_t &partition_start) {
         if (partition < big_partition_count) {
             partition_size = max_partition_size;
             partition_start = max_partition_size * partition;
@@ -370,46 +656,284 @@ vector<Ciphertext> PSISender::compute_matches(vector<uint64_t> &inputs,
             partition_size = max_partition_size - 1;
             partition_start = max_partition_size * partition - (partition - big_partition_count);
         }
+    };
+
+    // the coefficients are filled in slot by slot, and only encoded once they
+    // are all there.
+    size_t polynomial_count = 1 + (labeled ? chunks.size() : 0);
+    if (storage.coefficients_path.empty()) {
+        partitions.resize(this->partition_count);
+        for (size_t index = 0; index < this->partition_count; index++) {
+            size_t partition_size, partition_start;
+            partition_rows(first_partition + index, partition_size, partition_start);
+            partitions[index].f_coeffs.resize(partition_size + 1);
+            partitions[index].g_coeffs.assign(polynomial_count - 1, vector<Plaintext>(partition_size + 1));
+            for (size_t j = 0; j < partition_size + 1; j++) {
+                partitions[index].f_coeffs[j].resize(bucket_count);
+                for (auto &chunk_coeffs : partitions[index].g_coeffs) {
+                    chunk_coeffs[j].resize(bucket_count);
+                }
+            }
+        }
+    } else {
+        vector<size_t> coefficient_counts(this->partition_count);
+        for (size_t index = 0; index < this->partition_count; index++) {
+            size_t partition_size, partition_start;
+            partition_rows(first_partition + index, partition_size, partition_start);
+            coefficient_counts[index] = partition_size + 1;
+        }
+        coefficient_file = make_shared<CoefficientFile>(
+            storage.coefficients_path, bucket_count, polynomial_count - 1, coefficient_counts);
+    }
+
+    // for each bucket in a slice of the hash table, compute the coefficients
+    // of the polynomial f(x) = \prod_{y in bucket} (x - y) of every partition.
+    // optionally, also compute coeffs of g(x), which has the property
+    // g(y) = label(y) for each y in bucket.
+    auto precompute_slice = [&](size_t first_bucket, size_t slice_buckets, vector<bucket_slot> &slice) {
+        // the partitions are independent of each other, so they are
+        // precomputed in parallel.
+        parallel_for(pool, this->partition_count, [&](size_t index) {
+            size_t partition = first_partition + index;
+            size_t partition_size, partition_start;
+            partition_rows(partition, partition_size, partition_start);
+
+            vector<uint64_t> current_bucket(partition_size);
+            vector<vector<uint64_t>> bucket_f_coeffs(slice_buckets);
+            // we'll only need these if we're doing labeled PSI, so we set the
+            // sizes to 0 if we aren't to avoid unnecessarily wasting memory
+            vector<size_t> current_items(labeled ? partition_size : 0);
+            vector<uint64_t> current_labels(labeled ? partition_size : 0);
+            vector<vector<vector<uint64_t>>> bucket_g_coeffs(labeled ? chunks.size() : 0,
+                                                             vector<vector<uint64_t>>(slice_buckets));
+
+            for (size_t j = 0; j < slice_buckets; j++) {
+                current_bucket.resize(partition_size);
+                for (size_t k = 0; k < partition_size; k++) {
+                    current_bucket[k] = params.encode_bucket_element(
+                        inputs,
+                        slice[j * capacity + partition_start + k],
+                        false
+                    );
+                }
 
-        // for each bucket, compute the coefficients of the polynomial
-        // f(x) = \prod_{y in bucket} (x - y)
-        // optionally, also compute coeffs of g(x), which has the property
-        // g(y) = label(y) for each y in bucket.
-        for (size_t j = 0; j < bucket_count; j++) {
-            current_bucket.resize(partition_size);
-            for (size_t k = 0; k < partition_size; k++) {
-                current_bucket[k] = params.encode_bucket_element(
-                    inputs,
-                    buckets[j * capacity + partition_start + k],
-                    false
-                );
+                polynomial_from_roots(current_bucket, bucket_f_coeffs[j], plain_modulus);
+                assert(bucket_f_coeffs[j].size() == partition_size + 1);
+
+                if (labeled) {
+                    size_t nonempty_slots = 0;
+                    for (size_t k = 0; k < partition_size; k++) {
+                        size_t slot_index = j * capacity + partition_start + k;
+                        if (slice[slot_index] != BUCKET_EMPTY) {
+                            current_bucket[nonempty_slots] = current_bucket[k];
+                            current_items[nonempty_slots] = slice[slot_index].first;
+                            nonempty_slots++;
+                        }
+                    }
+                    current_bucket.resize(nonempty_slots);
+
+                    // every chunk of every column gets its own polynomial g,
+                    // which goes through the same points.
+                    current_labels.resize(nonempty_slots);
+                    for (size_t c = 0; c < chunks.size(); c++) {
+                        auto &column = label_columns.value()[chunks[c].first];
+                        for (size_t k = 0; k < nonempty_slots; k++) {
+                            current_labels[k] = (column[current_items[k]] >> chunks[c].second) & chunk_mask;
+                        }
+                        polynomial_from_points(current_bucket, current_labels, bucket_g_coeffs[c][j], plain_modulus);
+                    }
+                }
             }
 
-            polynomial_from_roots(current_bucket, f_coeffs[j], plain_modulus);
-            assert(f_coeffs[j].size() == partition_size + 1);
+            // the jth coefficients of all polynomials go into the slice's
+            // slots of one plaintext
+            vector<uint64_t> slots(slice_buckets);
+            auto store_slots = [&](size_t polynomial, size_t j) {
+                if (coefficient_file) {
+                    coefficient_file->write_slots(index, polynomial, j, first_bucket, slots.data(), slice_buckets);
+                } else {
+                    Plaintext &coeffs = (polynomial == 0)
+                                            ? partitions[index].f_coeffs[j]
+                                            : partitions[index].g_coeffs[polynomial - 1][j];
+                    copy(slots.begin(), slots.end(), coeffs.data() + first_bucket);
+                }
+            };
+            for (size_t j = 0; j < partition_size + 1; j++) {
+                for (size_t k = 0; k < slice_buckets; k++) {
+                    slots[k] = bucket_f_coeffs[k][j];
+                }
+                store_slots(0, j);
 
-            if (labels.has_value()) {
-                current_labels.resize(partition_size);
-                size_t nonempty_slots = 0;
-                for (size_t k = 0; k < partition_size; k++) {
-                    size_t slot_index = j * capacity + partition_start + k;
-                    if (buckets[slot_index] != BUCKET_EMPTY) {
-                        current_bucket[nonempty_slots] = current_bucket[k];
-                        current_labels[nonempty_slots] = labels.value()[buckets[slot_index].first];
-                        nonempty_slots++;
+                for (size_t c = 0; labeled && (c < chunks.size()); c++) {
+                    for (size_t k = 0; k < slice_buckets; k++) {
+                        slots[k] = (j < bucket_g_coeffs[c][k].size())
+                                       ? bucket_g_coeffs[c][k][j]
+                                       : 0;
                     }
+                    store_slots(1 + c, j);
                 }
+            }
+        });
+    };
 
-                current_bucket.resize(nonempty_slots);
-                current_labels.resize(nonempty_slots);
-                polynomial_from_points(current_bucket, current_labels, g_coeffs[j], plain_modulus);
+    // hash all of the sender's inputs, using every possible hash function, into
+    // a (capacity × bucket_count) hash table, which is precomputed slice by
+    // slice.
+    size_t table_memory = (storage.table_memory == 0) ? SIZE_MAX : storage.table_memory;
+    bool res = complete_hash_slices(random, inputs, bucket_count_log, capacity, params.seeds,
+                                    table_memory, storage.temp_directory, precompute_slice);
+    assert(res); // TODO: handle gracefully
+
+    // finally, every plaintext is encoded.
+    parallel_for(pool, this->partition_count, [&](size_t index) {
+        PartitionCoefficients file_coefficients;
+        if (coefficient_file) {
+            coefficient_file->read_partition(index, file_coefficients);
+        }
+        PartitionCoefficients &coefficients = coefficient_file ? file_coefficients : partitions[index];
+
+        for (Plaintext &f_coeffs_enc : coefficients.f_coeffs) {
+            encoder.encode(f_coeffs_enc);
+        }
+        for (auto &chunk_coeffs : coefficients.g_coeffs) {
+            for (Plaintext &g_coeffs_enc : chunk_coeffs) {
+                encoder.encode(g_coeffs_enc);
             }
         }
 
-        // we are done with sender's precomputation. now we can actually
-        // evaluate the polynomial on the receiver's input.
-        Ciphertext f_evaluated;
-        Ciphertext g_evaluated;
+        if (coefficient_file) {
+            coefficient_file->write_partition(index, coefficients);
+        }
+    });
+}
+
+bool SenderDatabase::compatible_with(PSIParams &params) const
+{
+    return (params.context->first_parms_id() == parms_id)
+           && (params.sender_size == sender_size)
+           && (params.input_bits == input_bits)
+           && (params.sender_partition_count() == total_partition_count)
+           && (params.seeds == seeds)
+           && (params.label_column_bits() == label_column_bits);
+}
+
+PSISender::PSISender(PSIParams &params, size_t thread_count)
+    : params(params),
+      encoder(params.context),
+      evaluator(params.context),
+      own_pool(make_unique<ThreadPool>(thread_count)),
+      pool(*own_pool),
+      receiver_public_key(nullptr)
+{}
+
+PSISender::PSISender(PSIParams &params, shared_ptr<const SenderDatabase> database, ThreadPool &pool)
+    : params(params),
+      database(database),
+      encoder(params.context),
+      evaluator(params.context),
+      pool(pool),
+      receiver_public_key(nullptr)
+{}
+
+void PSISender::set_database(vector<uint64_t> &inputs, optional<vector<uint64_t>> &labels)
+{
+    optional<vector<vector<uint64_t>>> label_columns;
+    if (labels.has_value()) {
+        label_columns = vector<vector<uint64_t>>{labels.value()};
+    }
+    set_database(inputs, label_columns);
+}
+
+void PSISender::set_database(vector<uint64_t> &inputs, optional<vector<vector<uint64_t>>> &label_columns)
+{
+    database = make_shared<SenderDatabase>(params, inputs, label_columns, pool);
+}
+
+const vector<Ciphertext> &PSISender::compute_matches(const PublicKey &receiver_public_key,
+                                              const RelinKeys &relin_keys,
+                                              vector<Ciphertext> &receiver_inputs)
+{
+    start_query(receiver_public_key, relin_keys);
+    for (size_t i = 0; i < receiver_inputs.size(); i++) {
+        add_query_window(i, receiver_inputs[i]);
+    }
+    return finish_query();
+}
+
+void PSISender::start_query(const PublicKey &receiver_public_key, const RelinKeys &relin_keys)
+{
+    assert(database && database->compatible_with(params));
+    assert(!powers_computation);
+
+    this->receiver_public_key = &receiver_public_key;
+    windowing.emplace(params.windowing());
+
+    // compute all the powers of the receiver's input, as its windows arrive.
+    // the ciphertexts are kept between queries, so their memory is reused.
+    powers.resize(params.max_partition_size() + 1);
+    powers_computation = make_unique<PowersComputation>(
+        windowing.value(), powers, evaluator, relin_keys, pool);
+}
+
+void PSISender::add_query_window(size_t index, const Ciphertext &window)
+{
+    assert(powers_computation);
+    powers_computation->add_window(index, window);
+}
+
+const vector<Ciphertext> &PSISender::finish_query(function<void(size_t, Ciphertext &)> on_result_ready)
+{
+    assert(powers_computation);
+    powers_computation->wait();
+    powers_computation.reset();
+
+    auto random_factory = UniformRandomGeneratorFactory::default_factory();
+    uint64_t plain_modulus = params.plain_modulus();
+
+    Encryptor encryptor(params.context, *receiver_public_key);
+
+    size_t partition_count = database->partition_count;
+
+    // if we're doing labeled PSI, we need one ciphertext for f(x) and one for
+    // r*f(x) + g(x) per chunk of the labels, for every partition
+    bool labeled = database->labeled;
+    size_t chunk_count = labeled ? params.label_chunks().size() : 0;
+    size_t results_per_partition = 1 + chunk_count;
+    // the results of the last query are overwritten, so their memory is
+    // reused.
+    results.resize(results_per_partition * partition_count);
+
+    // if the coefficients are on disk, they're read in order while the
+    // partitions before them are evaluated. every thread (and the calling
+    // thread, which helps) evaluates one partition at a time, and one more
+    // partition is read ahead.
+    unique_ptr<PartitionLoader> loader;
+    if (database->coefficient_file) {
+        loader = make_unique<PartitionLoader>(*database->coefficient_file, pool.thread_count() + 2);
+    }
+
+    // every partition is evaluated by its own task.
+    auto evaluate_partition = [&](size_t partition) {
+        // random generators are not thread-safe, so every task needs its own.
+        auto random = random_factory->create();
+        optional<LoadedPartition> loaded;
+        const PartitionCoefficients *coefficients;
+        if (loader) {
+            loaded.emplace(*loader, partition);
+            coefficients = &loaded->coefficients();
+        } else {
+            coefficients = &database->partitions[partition];
+        }
+        size_t partition_size = coefficients->f_coeffs.size() - 1;
+        // every thread reuses its buffer for the terms.
+        thread_local Ciphertext term(thread_memory_pool());
+
+        // the sender's polynomials were precomputed by set_database, so we
+        // can directly evaluate them on the receiver's input. all chunks of the
+        // labels share the same powers, and are evaluated in their results.
+        size_t first_result = results_per_partition * partition;
+        Ciphertext &f_evaluated = results[first_result];
+        Ciphertext *g_evaluated = &results[first_result + 1];
 
 #ifdef DEBUG_WITH_KEY_LEAK
         Decryptor decryptor(params.context, *receiver_key_leaked);
@@ -417,46 +941,28 @@ vector<Ciphertext> PSISender::compute_matches(vector<uint64_t> &inputs,
 #endif
 
         for (size_t j = 0; j < partition_size + 1; j++) {
-            // encode the jth coefficients of all polynomials into a vector
-            Plaintext f_coeffs_enc(bucket_count, bucket_count);
-            for (size_t k = 0; k < bucket_count; k++) {
-                f_coeffs_enc[k] = f_coeffs[k][j];
-            }
-            encoder.encode(f_coeffs_enc);
-
-            Plaintext g_coeffs_enc;
-            if (labels.has_value()) {
-                g_coeffs_enc.resize(bucket_count);
-                for (size_t k = 0; k < bucket_count; k++) {
-                    g_coeffs_enc[k] = (j < g_coeffs[k].size())
-                                         ? g_coeffs[k][j]
-                                         : 0;
-                }
-                encoder.encode(g_coeffs_enc);
-            }
-
+            const Plaintext &f_coeffs_enc = coefficients->f_coeffs[j];
             if (j == 0) {
                 // the constant term just goes straight into the result, and
                 // then the other terms will be added into it later.
-                encryptor.encrypt(f_coeffs_enc, f_evaluated);
-                if (labels.has_value()) {
-                    encryptor.encrypt(g_coeffs_enc, g_evaluated);
+                encryptor.encrypt(f_coeffs_enc, f_evaluated, thread_memory_pool());
+                for (size_t c = 0; c < chunk_count; c++) {
+                    encryptor.encrypt(coefficients->g_coeffs[c][j], g_evaluated[c], thread_memory_pool());
                 }
             } else {
                 // term = receiver_inputs^j * f_coeffs_enc
                 // multiply_plain does not allow the second parameter to be zero.
                 if (!f_coeffs_enc.is_zero()) {
-                    Ciphertext term;
-                    evaluator.multiply_plain(powers[j], f_coeffs_enc, term);
-                    evaluator.relinearize_inplace(term, relin_keys);
+                    evaluator.multiply_plain(powers[j], f_coeffs_enc, term, thread_memory_pool());
                     evaluator.add_inplace(f_evaluated, term);
                 }
 
-                if (!g_coeffs_enc.is_zero()) {
-                    Ciphertext term;
-                    evaluator.multiply_plain(powers[j], g_coeffs_enc, term);
-                    evaluator.relinearize_inplace(term, relin_keys);
-                    evaluator.add_inplace(g_evaluated, term);
+                for (size_t c = 0; c < chunk_count; c++) {
+                    const Plaintext &g_coeffs_enc = coefficients->g_coeffs[c][j];
+                    if (!g_coeffs_enc.is_zero()) {
+                        evaluator.multiply_plain(powers[j], g_coeffs_enc, term, thread_memory_pool());
+                        evaluator.add_inplace(g_evaluated[c], term);
+                    }
                 }
             }
 
@@ -466,31 +972,37 @@ vector<Ciphertext> PSISender::compute_matches(vector<uint64_t> &inputs,
         }
 
         // for unlabeled PSI, return r * f(x)
-        // for labeled PSI, return (r * f(x), r' * f(x) + g(x))
-        // where r and r' are random.
-        multiply_by_random_mask(f_evaluated, random, encoder, evaluator, relin_keys, plain_modulus);
+        // for labeled PSI, return (r * f(x), r_1 * f(x) + g_1(x), ...)
+        // where r and every r_c are random and independent, so that no two
+        // chunks can be combined to learn anything about f(x).
+        multiply_by_random_mask(f_evaluated, random, encoder, evaluator, plain_modulus);
 
 #ifdef DEBUG_WITH_KEY_LEAK
         cerr << "after mask it is " << decryptor.invariant_noise_budget(f_evaluated) << endl;
 #endif
 
-        if (labels.has_value()) {
-            result[2 * partition] = f_evaluated;
-
-            multiply_by_random_mask(f_evaluated, random, encoder, evaluator, relin_keys, plain_modulus);
+        for (size_t c = 0; c < chunk_count; c++) {
+            term = f_evaluated;
+            multiply_by_random_mask(term, random, encoder, evaluator, plain_modulus);
+            evaluator.add_inplace(g_evaluated[c], term);
 
 #ifdef DEBUG_WITH_KEY_LEAK
-            cerr << "after second mask it is " << decryptor.invariant_noise_budget(f_evaluated) << endl;
+            cerr << "after final add of chunk " << c << " it is " << decryptor.invariant_noise_budget(g_evaluated[c]) << endl;
 #endif
-            evaluator.add(f_evaluated, g_evaluated, result[2 * partition + 1]);
-
-#ifdef DEBUG_WITH_KEY_LEAK
-            cerr << "after final add it is " << decryptor.invariant_noise_budget(result[2 * partition + 1]) << endl;
-#endif
-        } else {
-            result[partition] = f_evaluated;
         }
+    };
+
+    if (on_result_ready) {
+        // hand the results over in order, each partition's as soon as it's done.
+        parallel_for_in_order(pool, partition_count, evaluate_partition, [&](size_t partition) {
+            for (size_t i = 0; i < results_per_partition; i++) {
+                size_t index = results_per_partition * partition + i;
+                on_result_ready(index, results[index]);
+            }
+        });
+    } else {
+        parallel_for(pool, partition_count, evaluate_partition);
     }
 
-    return result;
+    return results;
 }
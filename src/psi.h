@@ -1,14 +1,32 @@
 #pragma once
+#include <functional>
+#include <future>
 #include <vector>
 #include <optional>
 
 #include "seal/seal.h"
 
+#include "coefficient_file.h"
 #include "hashing.h"
+#include "key_store.h"
+#include "thread_pool.h"
+#include "windowing.h"
+#include "zero_pool.h"
 
 using namespace std;
 using namespace seal;
 
+// the decomposition bit count of the receiver's relinearization keys.
+const int RELIN_KEYS_DECOMPOSITION_BIT_COUNT = 8;
+
+/* multiplies every slot of the ciphertext by a random nonzero value, so that
+   the receiver only learns which of the sender's results are zero. */
+void multiply_by_random_mask(Ciphertext &ciphertext,
+                             shared_ptr<UniformRandomGenerator> random,
+                             BatchEncoder &encoder,
+                             Evaluator &evaluator,
+                             uint64_t plain_modulus);
+
 class PSIParams
 {
 public:
@@ -22,10 +40,34 @@ public:
     size_t bucket_count_log();
     size_t sender_bucket_capacity();
     size_t sender_partition_count();
+    size_t max_partition_size();
     size_t window_size();
+    size_t poly_modulus_degree();
+    vector<uint64_t> &power_basis();
 
     void set_sender_partition_count(size_t new_value);
     void set_window_size(size_t new_value);
+    /* if a power basis is set (e.g. one from plan_power_basis), the receiver
+       sends those powers of its input instead of using windowing. */
+    void set_power_basis(vector<uint64_t> new_value);
+
+    /* a labeled set's labels can consist of several columns, each of which
+       has its own width. a column wider than label_chunk_bits() is split into
+       chunks of that many bits, each of which the sender evaluates with its
+       own polynomial, using the same powers of the receiver's input. by
+       default, there is a single column of label_chunk_bits() bits. */
+    size_t label_chunk_bits();
+    vector<size_t> label_column_bits();
+    void set_label_column_bits(vector<size_t> new_value);
+    /* the column of every chunk, and the offset of its lowest bit in that
+       column, in the order in which the sender returns them. */
+    vector<pair<size_t, size_t>> label_chunks();
+
+    Windowing windowing();
+    /* the sender only needs the receiver's relinearization keys if it has to
+       compute some powers by itself. it doesn't if the power basis contains
+       every power, e.g. plan_power_basis(max_partition_size(), 0). */
+    bool needs_relin_keys();
 
     uint64_t encode_bucket_element(vector<uint64_t> &inputs, bucket_slot &element, bool is_receiver);
 
@@ -39,35 +81,224 @@ private:
     size_t poly_modulus_degree_;
     size_t sender_partition_count_;
     size_t window_size_;
+    vector<uint64_t> power_basis_;
+    vector<size_t> label_column_bits_;
+};
+
+/* the receiver's inputs that are in the intersection, with their labels. the
+   buffers keep their capacity, so reusing an InputMatches for every query
+   means that decrypting doesn't allocate anything once they're big enough. */
+struct InputMatches
+{
+    // the number of labels of every match, i.e. the number of label columns,
+    // or 0 if the set isn't labeled.
+    size_t label_count;
+    // indices into the receiver's inputs.
+    vector<size_t> inputs;
+    // labels[i * label_count + c] is the label of inputs[i] in column c.
+    vector<uint64_t> labels;
 };
 
 class PSIReceiver
 {
 public:
-    PSIReceiver(PSIParams &params);
-    vector<Ciphertext> encrypt_inputs(vector<uint64_t> &inputs, vector<bucket_slot> &buckets);
+    /* thread_count = 0 means one thread per hardware thread.
+       if params.needs_relin_keys(), the relinearization keys are generated in
+       the background, while the inputs are being encrypted.
+       if a key store is given, the keys are taken from it if it has keys for
+       these parameters, and saved to it otherwise. */
+    PSIReceiver(PSIParams &params, size_t thread_count = 0, KeyStore *key_store = nullptr);
+    /* if on_window_ready is given, it is called with each encrypted input as
+       soon as it (and every one before it) is ready, e.g. to send it. */
+    vector<Ciphertext> encrypt_inputs(vector<uint64_t> &inputs,
+                                      vector<bucket_slot> &buckets,
+                                      function<void(size_t, Ciphertext &)> on_window_ready = nullptr);
+    /* the functions that take the whole response decrypt its partitions in
+       parallel. the matches are buckets of the receiver's hash table, in the
+       order of the partitions they were found in. */
     vector<size_t> decrypt_matches(vector<Ciphertext> &encrypted_matches);
+    /* only for labels that consist of a single chunk. */
     vector<pair<size_t, uint64_t>> decrypt_labeled_matches(vector<Ciphertext> &encrypted_matches);
+    /* for labels with any number of columns, every match comes with its
+       label in every column. for every partition, the sender returns the
+       matches, followed by one ciphertext per label chunk. */
+    vector<pair<size_t, vector<uint64_t>>> decrypt_label_columns(vector<Ciphertext> &encrypted_matches);
+    /* like the functions above, but looks up the input in every matching
+       bucket, with the buckets from encrypt_inputs. works for labeled and
+       unlabeled responses alike. */
+    void decrypt_input_matches(vector<Ciphertext> &encrypted_matches,
+                               vector<bucket_slot> &buckets,
+                               InputMatches &result);
+    /* decrypt the sender's response for a single partition, so that it can
+       be decrypted as soon as it arrives, and append its matches to result.
+       the functions above do this for every partition. */
+    void decrypt_partition_matches(Ciphertext &encrypted_matches, vector<size_t> &result);
+    void decrypt_partition_labeled_matches(Ciphertext &encrypted_matches,
+                                           Ciphertext &encrypted_labels,
+                                           vector<pair<size_t, uint64_t>> &result);
+    /* encrypted_labels points to the partition's label chunks. */
+    void decrypt_partition_label_columns(Ciphertext &encrypted_matches,
+                                         Ciphertext *encrypted_labels,
+                                         vector<pair<size_t, vector<uint64_t>>> &result);
     PublicKey& public_key();
-    RelinKeys relin_keys();
+    /* blocks until the keys are ready. they are only generated once. */
+    const RelinKeys &relin_keys();
+    /* true if relin_keys() would not block. */
+    bool relin_keys_ready();
+    /* the fingerprints that identify the keys to the sender's KeyCache.
+       relin_keys_fingerprint blocks like relin_keys. */
+    const fingerprint_type &public_key_fingerprint();
+    const fingerprint_type &relin_keys_fingerprint();
+
+    /* starts precomputing encryptions of zero in the background, which
+       encrypt_inputs will then use instead of encrypting from scratch. if path
+       is given, unused zeros are kept there between sessions. */
+    ZeroPool &enable_zero_pool(size_t capacity, string path = "");
 
 private:
+    void start_relin_keys();
+    /* decrypts every partition of the response in parallel. match_buckets is
+       set to the matching buckets, and labels to their labels in every column,
+       as in InputMatches. */
+    void decrypt_response(vector<Ciphertext> &encrypted_matches,
+                          vector<size_t> &match_buckets,
+                          vector<uint64_t> &labels);
+
     PSIParams &params;
-    KeyGenerator keygen;
+    KeyStore *key_store;
+    unique_ptr<KeyGenerator> keygen;
     PublicKey public_key_;
     SecretKey secret_key;
+    shared_future<RelinKeys> relin_keys_;
+    fingerprint_type public_key_fingerprint_;
+    fingerprint_type relin_keys_fingerprint_;
+    unique_ptr<ZeroPool> zero_pool;
+    // NB: this must be declared last, so that it finishes all of its tasks
+    // before anything they use is destroyed.
+    ThreadPool pool;
+};
+
+/* where a SenderDatabase keeps what doesn't fit into memory. by default,
+   everything is in memory. */
+struct DatabaseStorage
+{
+    // if not empty, the coefficients are kept in a file there instead (see
+    // CoefficientFile), so that only a couple of partitions per thread need to
+    // be in memory while answering queries.
+    string coefficients_path;
+    // if not 0, the hash table is built in slices of buckets that take up at
+    // most about this many bytes, through temporary files in temp_directory
+    // (see complete_hash_slices).
+    size_t table_memory = 0;
+    string temp_directory = "/tmp";
+};
+
+/*
+SenderDatabase holds the sender's hashed set as precomputed polynomials, which
+only depend on the set and the params, not on the receiver's keys or power
+basis. Once built, it is never modified, so a single database can be shared by
+any number of PSISenders (e.g. one per receiver session) answering queries
+concurrently.
+*/
+
+class SenderDatabase
+{
+public:
+    /* hashes the sender's set and precomputes its polynomials in the pool.
+       if partition_count is given, only the partitions first_partition to
+       first_partition + partition_count - 1 are precomputed, so that several
+       workers can each evaluate their share of the partitions of every query.
+       the workers must all hash the whole set, and shuffle the hash table the
+       same way, so they must be given random generators in the same state
+       (see AESRandomGenerator). by default, the table is shuffled with a
+       generator from SEAL's default factory.
+       label_columns[c][i] is the label of inputs[i] in column c, which must
+       fit into params.label_column_bits()[c] bits.
+       the coefficients are precomputed one slice of the hash table at a
+       time, so with storage.coefficients_path and storage.table_memory, a set
+       whose table and coefficients don't fit into memory can be built. */
+    SenderDatabase(PSIParams &params,
+                   vector<uint64_t> &inputs,
+                   optional<vector<vector<uint64_t>>> &label_columns,
+                   ThreadPool &pool,
+                   shared_ptr<UniformRandomGenerator> random = nullptr,
+                   size_t first_partition = 0,
+                   size_t partition_count = 0,
+                   const DatabaseStorage &storage = DatabaseStorage());
+
+    /* whether the database can answer queries made with these params, which
+       may only differ from the database's in their power basis or window
+       size. */
+    bool compatible_with(PSIParams &params) const;
+
+    bool labeled;
+    // the partitions this database holds, out of params.sender_partition_count().
+    size_t first_partition;
+    size_t partition_count;
+    // partitions[p] contains the coefficients of partition first_partition + p,
+    // unless they're in coefficient_file, and then partitions is empty.
+    vector<PartitionCoefficients> partitions;
+    shared_ptr<const CoefficientFile> coefficient_file;
+
+private:
+    parms_id_type parms_id;
+    size_t sender_size;
+    size_t input_bits;
+    size_t total_partition_count;
+    vector<uint64_t> seeds;
+    vector<size_t> label_column_bits;
 };
 
 class PSISender
 {
 public:
-    PSISender(PSIParams &params);
-    vector<Ciphertext> compute_matches(vector<uint64_t> &inputs,
-                                       optional<vector<uint64_t>> &labels,
-                                       PublicKey& receiver_public_key,
-                                       RelinKeys relin_keys,
-                                       vector<Ciphertext> &receiver_inputs);
+    /* thread_count = 0 means one thread per hardware thread. */
+    PSISender(PSIParams &params, size_t thread_count = 0);
+    /* a sender that answers queries from a shared database, using a shared
+       pool. params may differ from the database's in their power basis. */
+    PSISender(PSIParams &params, shared_ptr<const SenderDatabase> database, ThreadPool &pool);
+    /* builds a new database for the sender's set. this must be done before the
+       first query (and again whenever the set changes), but then any number of
+       queries can be answered without repeating it. */
+    void set_database(vector<uint64_t> &inputs, optional<vector<uint64_t>> &labels);
+    /* see SenderDatabase for the layout of label_columns. */
+    void set_database(vector<uint64_t> &inputs, optional<vector<vector<uint64_t>>> &label_columns);
+    /* the results are only valid until the next query. */
+    const vector<Ciphertext> &compute_matches(const PublicKey &receiver_public_key,
+                                              const RelinKeys &relin_keys,
+                                              vector<Ciphertext> &receiver_inputs);
+
+    /* compute_matches is equivalent to start_query, then add_query_window for
+       every one of the receiver's ciphertexts, then finish_query. adding the
+       windows one by one, as soon as each is received, starts computing the
+       powers of the receiver's input before the whole query has arrived.
+       the keys must not be destroyed before finish_query returns. */
+    void start_query(const PublicKey &receiver_public_key, const RelinKeys &relin_keys);
+    void add_query_window(size_t index, const Ciphertext &window);
+    /* the database's partitions are evaluated in parallel, and the results
+       are those of its partitions only. if on_result_ready is given,
+       it is called (on the calling thread) with each result in order, as soon
+       as that result is ready, e.g. to send it. for a labeled set, all of the
+       results of a partition are ready at the same time. */
+    const vector<Ciphertext> &finish_query(function<void(size_t, Ciphertext &)> on_result_ready = nullptr);
 
 private:
     PSIParams &params;
+    shared_ptr<const SenderDatabase> database;
+    BatchEncoder encoder;
+    Evaluator evaluator;
+    // only set if the sender has a pool of its own. every method waits for
+    // its tasks before returning, and the tasks of an unfinished query are
+    // waited for when powers_computation is destroyed, so unlike elsewhere
+    // the pool doesn't have to be destroyed first.
+    unique_ptr<ThreadPool> own_pool;
+    ThreadPool &pool;
+    // the powers of the last query's input, and the last query's results,
+    // whose memory is reused.
+    vector<Ciphertext> powers;
+    vector<Ciphertext> results;
+    // the state of the query that is currently being answered.
+    const PublicKey *receiver_public_key;
+    optional<Windowing> windowing;
+    unique_ptr<PowersComputation> powers_computation;
 };
@@ -1,4 +1,7 @@
 #include <cassert>
+#include <cstring>
+#include <numeric>
+#include <vector>
 
 #include "random.h"
 
@@ -51,3 +54,68 @@ uint64_t random_nonzero_integer(shared_ptr<UniformRandomGenerator> random, uint6
 
     return result;
 }
+
+AESRandomGenerator::AESRandomGenerator(uint64_t key_high, uint64_t key_low)
+    : counter(0), next(4) {
+    aes.set_key(key_high, key_low);
+}
+
+uint32_t AESRandomGenerator::generate() {
+    if (next == 4) {
+        pair<uint64_t, uint64_t> encrypted = aes.encrypt(0, counter++);
+        memcpy(block, &encrypted.first, sizeof(uint64_t));
+        memcpy(block + 2, &encrypted.second, sizeof(uint64_t));
+        next = 0;
+    }
+    return block[next++];
+}
+
+// four rounds make a Feistel network a strong pseudorandom permutation if its
+// round function is a pseudorandom function [Luby-Rackoff].
+const size_t FEISTEL_ROUNDS = 4;
+
+AESPermutation::AESPermutation(uint64_t key_high, uint64_t key_low, size_t bits)
+    : bits(bits), half_bits((bits + 1) / 2) {
+    assert((bits > 0) && (bits <= 64));
+    aes.set_key(key_high, key_low);
+}
+
+void AESPermutation::permute(const uint64_t *values, size_t count, uint64_t *results) {
+    uint64_t half_mask = (1ull << half_bits) - 1;
+    vector<size_t> pending(count);
+    iota(pending.begin(), pending.end(), 0);
+    for (size_t i = 0; i < count; i++) {
+        assert((bits == 64) || (values[i] >> bits == 0));
+        results[i] = values[i];
+    }
+
+    vector<uint64_t> left(count), right(count), round_output(count);
+    while (!pending.empty()) {
+        size_t pending_count = pending.size();
+        for (size_t k = 0; k < pending_count; k++) {
+            left[k] = results[pending[k]] >> half_bits;
+            right[k] = results[pending[k]] & half_mask;
+        }
+        // every round has its own function, which is AES with the round
+        // number in the high half of the block.
+        for (size_t round = 0; round < FEISTEL_ROUNDS; round++) {
+            aes.encrypt_low(round, right.data(), pending_count, round_output.data());
+            for (size_t k = 0; k < pending_count; k++) {
+                uint64_t new_right = left[k] ^ (round_output[k] & half_mask);
+                left[k] = right[k];
+                right[k] = new_right;
+            }
+        }
+
+        // the values that don't fit into bits go around again.
+        size_t still_pending = 0;
+        for (size_t k = 0; k < pending_count; k++) {
+            uint64_t result = (left[k] << half_bits) | right[k];
+            results[pending[k]] = result;
+            if ((bits < 2 * half_bits) && (result >> bits != 0)) {
+                pending[still_pending++] = pending[k];
+            }
+        }
+        pending.resize(still_pending);
+    }
+}
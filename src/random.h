@@ -3,6 +3,8 @@
 
 #include "seal/seal.h"
 
+#include "aes.h"
+
 using namespace seal;
 using namespace std;
 
@@ -15,3 +17,39 @@ uint64_t random_integer(shared_ptr<UniformRandomGenerator> random, uint64_t limi
 
 /* This helper function uniformly picks an integer x with 0 < x < limit. */
 uint64_t random_nonzero_integer(shared_ptr<UniformRandomGenerator> random, uint64_t limit);
+
+/* A UniformRandomGenerator whose output only depends on its key (it's AES in
+   counter mode), so that several processes can make the same random choices
+   without talking to each other. */
+class AESRandomGenerator : public UniformRandomGenerator
+{
+public:
+    AESRandomGenerator(uint64_t key_high, uint64_t key_low);
+    uint32_t generate() override;
+
+private:
+    AES aes;
+    uint64_t counter;
+    // the current block's 32-bit values, of which next is the next to output.
+    uint32_t block[4];
+    size_t next;
+};
+
+/* A pseudorandom permutation of the integers below 2^bits that only depends on
+   its key, e.g. to pick distinct values without remembering which ones were
+   already picked. It's a Feistel network on the two halves of a value, with AES
+   as its round function. If bits is odd, the network permutes one more bit, and
+   results that don't fit are permuted again until they do ("cycle walking"). */
+class AESPermutation
+{
+public:
+    AESPermutation(uint64_t key_high, uint64_t key_low, size_t bits);
+    /* values[i] must be less than 2^bits. the AES blocks of all the values are
+       encrypted in batches. */
+    void permute(const uint64_t *values, size_t count, uint64_t *results);
+
+private:
+    AES aes;
+    size_t bits;
+    size_t half_bits;
+};
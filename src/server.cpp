@@ -1,75 +1,832 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <cstdint>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
 #include "boost/asio.hpp"
 
+#include "admission.h"
+#include "cost_model.h"
+#include "key_cache.h"
+#include "memory_pools.h"
 #include "networking.h"
+#include "set_file.h"
 
 using namespace std;
 using namespace boost::asio;
 
-int main()
+// receivers' keys are kept between sessions, see KeyCache.
+const size_t PUBLIC_KEY_CACHE_SIZE = 1024;
+const size_t RELIN_KEYS_CACHE_SIZE = 16;
+// the largest set a receiver can query with. all receivers share the sender's
+// database, which depends on this.
+const size_t MAX_RECEIVER_SIZE = 5535;
+const size_t SENDER_PARTITION_COUNT = 16;
+// sessions are only admitted while the powers of all of their queries fit into
+// this much memory, and only if a single query takes at most this long. see
+// AdmissionControl.
+const size_t POWERS_MEMORY_BUDGET = 4ull << 30;
+const double MAX_QUERY_SECONDS = 60;
+
+// everything the sessions share. the params and the database are never
+// modified once the server is running.
+struct SharedState
 {
-    vector<uint64_t> inputs = {0x01, 0x02, 0x03, 0x04, 0x07, 0x22, 0xca, 0xfe};
-    vector<uint64_t> labels = {0x01, 0x01, 0x02, 0x03, 0x01, 0x02, 0x00, 0x03};
-    size_t input_bits = 32;
-    size_t poly_modulus_degree = 8192;
-    unsigned short port = 9999;
+    PSIParams &params;
+    shared_ptr<const SenderDatabase> database;
+    ThreadPool &pool;
+    KeyCache<PublicKey> &public_key_cache;
+    KeyCache<RelinKeys> &relin_keys_cache;
+    AdmissionControl &admission_control;
+    OperationTimings &timings;
+};
 
-    io_context context;
-    ip::tcp::acceptor acceptor(context);
-    ip::tcp::endpoint endpoint(ip::tcp::v4(), port);
-    acceptor.open(endpoint.protocol());
-    acceptor.set_option(ip::tcp::acceptor::reuse_address(true));
-    acceptor.bind(endpoint);
-    acceptor.listen();
+mutex log_mutex;
+atomic<size_t> session_count(0);
 
-    cout << "listening" << endl;
+// sessions run concurrently, so every message is prefixed with its session.
+void session_log(size_t session, const string &message)
+{
+    lock_guard<mutex> lock(log_mutex);
+    cout << "[" << session << "] " << message << endl;
+}
+
+// the receiver needs everything that the database depends on, and the widths
+// of the label columns to put the chunks of every label back together. an
+// unlabeled set has no label columns.
+void write_params(Networking &net, PSIParams &params, bool labeled)
+{
+    net.write_uint32(params.sender_size);
+    net.write_uint32(params.receiver_size);
+    net.write_uint32(params.sender_partition_count());
+    net.write_uint32(params.input_bits);
+    net.write_uint32(params.poly_modulus_degree());
+    net.write_uint64s(params.seeds);
+    vector<uint64_t> column_bits;
+    if (labeled) {
+        vector<size_t> bits = params.label_column_bits();
+        column_bits.assign(bits.begin(), bits.end());
+    }
+    net.write_uint64s(column_bits);
+}
+
+// the number of results the sender returns for every partition: the matches,
+// and for a labeled set, every chunk of the labels.
+size_t results_per_partition(PSIParams &params, bool labeled)
+{
+    return labeled ? (1 + params.label_chunks().size()) : 1;
+}
+
+// reads the receiver's power basis into params, where an empty one means that
+// the receiver uses our window size. the basis decides how much work the
+// session's queries are, so a basis that the receiver couldn't have planned
+// ends the session, before any of that work is done.
+void read_power_basis(Networking &net, PSIParams &params)
+{
+    vector<uint64_t> power_basis;
+    net.read_uint64s(power_basis, params.max_partition_size());
+    if (!power_basis.empty() && !valid_power_basis(power_basis, params.max_partition_size())) {
+        throw invalid_argument("invalid power basis");
+    }
+    params.set_power_basis(power_basis);
+}
+
+// the longest message that a key of key_bytes bytes of coefficients (see
+// QueryCost) can take up. SEAL's serialization adds a small header to every
+// polynomial, which the margin covers. longer keys are rejected before they're
+// buffered, since admission control doesn't count their memory.
+size_t max_key_message_size(size_t key_bytes)
+{
+    return key_bytes + key_bytes / 16 + 4096;
+}
+
+// a window must be a fresh encryption, as the receiver's encryptor makes them.
+void check_window(PSIParams &params, const Ciphertext &window)
+{
+    if ((window.parms_id() != params.context->first_parms_id()) || (window.size() != 2) || window.is_ntt_form()) {
+        throw invalid_argument("invalid window");
+    }
+}
 
-    ip::tcp::socket socket(context);
-    acceptor.accept(socket);
-    Networking net(socket);
+void serve(Networking &net, size_t session, SharedState &shared)
+{
+    net.set_seal_context(shared.params.context);
 
-    cout << "accepted, sending hello and set size" << endl;
+    session_log(session, "accepted, sending hello and params");
     net.write_hello();
-    net.write_uint32(inputs.size());
+    write_params(net, shared.params, shared.database->labeled);
 
-    cout << "waiting for hello" << endl;
+    session_log(session, "waiting for hello");
+    net.read_hello();
+    session_log(session, string("ciphertexts are ") + (net.packs_ciphertexts() ? "packed" : "not packed")
+                         + (net.shares_memory() ? ", in shared memory" : ""));
+    session_log(session, "waiting for power basis");
+
+    // the power basis only matters for this session's queries, so it goes
+    // into a copy of the shared params, which still shares their SEAL context.
+    PSIParams params = shared.params;
+    read_power_basis(net, params);
+
+    session_log(session, "waiting for key fingerprints");
+    fingerprint_type public_key_fingerprint, relin_keys_fingerprint;
+    net.read_fingerprint(public_key_fingerprint);
+    shared_ptr<const PublicKey> receiver_pk = shared.public_key_cache.find(public_key_fingerprint);
+    shared_ptr<const RelinKeys> receiver_rk;
+    if (params.needs_relin_keys()) {
+        net.read_fingerprint(relin_keys_fingerprint);
+        receiver_rk = shared.relin_keys_cache.find(relin_keys_fingerprint);
+    } else {
+        receiver_rk = make_shared<RelinKeys>();
+    }
+
+    // what this session's queries cost depends on its power basis. the
+    // session holds on to its share of the memory until it ends.
+    QueryCost cost(params, shared.database->labeled);
+    double query_seconds = cost.sender_time(shared.timings, shared.pool.thread_count());
+    unique_ptr<Admission> admission;
+    AdmissionResult result = shared.admission_control.admit(cost.sender_powers_bytes, query_seconds, admission);
+    if (result != ADMITTED) {
+        session_log(session, (result == REJECTED_BUSY) ? "rejected, too busy" : "rejected, too expensive");
+        net.write_uint32((result == REJECTED_BUSY) ? NET_STATUS_BUSY : NET_STATUS_TOO_EXPENSIVE);
+        net.flush();
+        return;
+    }
+    stringstream admitted;
+    admitted << "admitted, " << (cost.sender_powers_bytes >> 20) << " MiB of powers, about "
+             << query_seconds << " s per query";
+    session_log(session, admitted.str());
+    net.write_uint32(NET_STATUS_OK);
+
+    uint32_t missing_keys = 0;
+    if (!receiver_pk) {
+        missing_keys |= NET_SEND_PUBLIC_KEY;
+    }
+    if (!receiver_rk) {
+        missing_keys |= NET_SEND_RELIN_KEYS;
+    }
+    session_log(session, string("public key ") + (receiver_pk ? "cached" : "not cached")
+                         + ", relin keys " + (receiver_rk ? "cached or not needed" : "not cached"));
+    net.write_uint32(missing_keys);
+
+    if (!receiver_pk) {
+        session_log(session, "waiting for public key");
+        auto key = make_shared<PublicKey>();
+        net.read_public_key(*key, &public_key_fingerprint, max_key_message_size(cost.public_key_bytes));
+        shared.public_key_cache.insert(public_key_fingerprint, key);
+        receiver_pk = key;
+    }
+
+    // the session only has its own keys, queries and powers. the database and
+    // the pool are shared with every other session.
+    PSISender sender(params, shared.database, shared.pool);
+
+    // the ciphertexts are kept between queries, so that their memory can be
+    // reused when the next query is received.
+    vector<Ciphertext> receiver_inputs;
+    size_t query_count = 0;
+    while (true) {
+        uint32_t request_id;
+        uint32_t frame = net.read_frame_header(request_id);
+        if (frame == NET_FRAME_END) {
+            break;
+        }
+        if (frame != NET_FRAME_QUERY) {
+            throw invalid_argument("expected a query, got frame " + to_string(frame));
+        }
+
+        // the pool runs the tasks with the earliest deadline first, so a
+        // cheap query isn't stuck behind an expensive one that arrived
+        // earlier, and a query that has waited long enough goes first.
+        TaskDeadline deadline(std::chrono::steady_clock::now()
+                              + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                  std::chrono::duration<double>(query_seconds)));
+
+        // the receiver sends its windows one by one, as soon as it has
+        // encrypted them, and we start computing the powers of each window as
+        // soon as we've received it, while the next ones are still arriving.
+        // a query is checked as it arrives, so that a malformed one ends only
+        // this session.
+        size_t window_count = net.read_ciphertexts_start();
+        if (window_count != params.windowing().ciphertext_count()) {
+            throw invalid_argument("expected " + to_string(params.windowing().ciphertext_count())
+                                   + " windows, got " + to_string(window_count));
+        }
+        receiver_inputs.resize(window_count);
+        bool streaming = (receiver_rk != nullptr);
+        if (streaming) {
+            sender.start_query(*receiver_pk, *receiver_rk);
+        }
+        for (size_t i = 0; i < receiver_inputs.size(); i++) {
+            net.read_ciphertext(receiver_inputs[i]);
+            check_window(params, receiver_inputs[i]);
+            if (streaming) {
+                sender.add_query_window(i, receiver_inputs[i]);
+            }
+        }
+
+        if (!streaming) {
+            // if we asked for them, the relin keys follow the first query, so
+            // that the receiver can generate them while it encrypts it. we
+            // can't compute any powers without them.
+            session_log(session, "waiting for relin keys");
+            auto keys = make_shared<RelinKeys>();
+            net.read_relin_keys(*keys, &relin_keys_fingerprint, max_key_message_size(cost.relin_keys_bytes));
+            shared.relin_keys_cache.insert(relin_keys_fingerprint, keys);
+            receiver_rk = keys;
+
+            sender.start_query(*receiver_pk, *receiver_rk);
+            for (size_t i = 0; i < receiver_inputs.size(); i++) {
+                sender.add_query_window(i, receiver_inputs[i]);
+            }
+        }
+
+        // every partition's result is sent as soon as it's ready, while the
+        // remaining partitions are still being evaluated. a worker only sends
+        // the results of its own partitions.
+        size_t result_count = results_per_partition(shared.params, shared.database->labeled);
+        net.write_frame_header(NET_FRAME_RESPONSE, request_id);
+        net.write_ciphertexts_start(result_count * shared.database->partition_count);
+        sender.finish_query([&](size_t, Ciphertext &result) {
+            net.write_ciphertext(result);
+            net.flush();
+        });
+        query_count++;
+    }
+
+    // the memory pools stop growing once every thread has evaluated a query.
+    MemoryPoolStats pool_stats = thread_memory_pool_stats();
+    stringstream message;
+    message << "session ended after " << query_count << " queries, the memory pools of "
+            << pool_stats.pool_count << " threads hold " << (pool_stats.allocated_bytes >> 20) << " MiB";
+    session_log(session, message.str());
+}
+
+// the partitions a worker evaluates, out of all of the sender's partitions.
+struct WorkerShard
+{
+    string address;
+    size_t first_partition;
+    size_t partition_count;
+};
+
+// everything the coordinator's sessions share.
+struct CoordinatorState
+{
+    PSIParams &params;
+    bool labeled;
+    io_context &context;
+    vector<WorkerShard> &shards;
+};
+
+// the coordinator talks to every worker like a receiver would, except that it
+// only passes on what the actual receiver sends, and merges the workers'
+// results into one response.
+void coordinate(Networking &net, size_t session, CoordinatorState &state)
+{
+    // every session has its own connection to every worker, so that the
+    // workers can tell the sessions apart.
+    size_t worker_count = state.shards.size();
+    vector<unique_ptr<Networking>> workers;
+    for (WorkerShard &shard : state.shards) {
+        workers.push_back(Networking::connect_to(state.context, shard.address));
+        workers.back()->set_seal_context(state.params.context);
+        workers.back()->write_hello();
+    }
+
+    net.set_seal_context(state.params.context);
+
+    session_log(session, "accepted, sending hello and params");
+    net.write_hello();
+    write_params(net, state.params, state.labeled);
+
+    // the workers were set up with our params, so they must agree with them,
+    // unless one of them was restarted with others since.
+    vector<uint64_t> expected_label_column_bits;
+    if (state.labeled) {
+        vector<size_t> bits = state.params.label_column_bits();
+        expected_label_column_bits.assign(bits.begin(), bits.end());
+    }
+    for (size_t i = 0; i < worker_count; i++) {
+        Networking &worker = *workers[i];
+        worker.read_hello();
+        vector<uint64_t> worker_params;
+        for (size_t k = 0; k < 5; k++) {
+            worker_params.push_back(worker.read_uint32());
+        }
+        vector<uint64_t> seeds, label_column_bits;
+        worker.read_uint64s(seeds);
+        worker.read_uint64s(label_column_bits);
+        vector<uint64_t> expected_params = {state.params.sender_size, state.params.receiver_size,
+                                            state.params.sender_partition_count(), state.params.input_bits,
+                                            state.params.poly_modulus_degree()};
+        if ((worker_params != expected_params) || (seeds != state.params.seeds)
+            || (label_column_bits != expected_label_column_bits)) {
+            throw runtime_error("worker " + state.shards[i].address + " has other params");
+        }
+    }
+
+    session_log(session, "waiting for hello");
+    net.read_hello();
+    session_log(session, "waiting for power basis and key fingerprints");
+    PSIParams params = state.params;
+    read_power_basis(net, params);
+    // only for the sizes of the keys, which we bound like the workers do.
+    QueryCost cost(params, state.labeled);
+    fingerprint_type public_key_fingerprint, relin_keys_fingerprint;
+    net.read_fingerprint(public_key_fingerprint);
+    if (params.needs_relin_keys()) {
+        net.read_fingerprint(relin_keys_fingerprint);
+    }
+
+    for (auto &worker : workers) {
+        worker->write_uint64s(params.power_basis());
+        worker->write_fingerprint(public_key_fingerprint);
+        if (params.needs_relin_keys()) {
+            worker->write_fingerprint(relin_keys_fingerprint);
+        }
+    }
+
+    // the session is only admitted if every worker admits it. the receiver
+    // must send any key that at least one of the workers doesn't have. if a
+    // worker rejects the session, we just close the connections to the others,
+    // which ends the session there too.
+    uint32_t status = NET_STATUS_OK;
+    vector<uint32_t> worker_missing_keys(worker_count, 0);
+    for (size_t i = 0; i < worker_count; i++) {
+        uint32_t worker_status = workers[i]->read_uint32();
+        if (worker_status != NET_STATUS_OK) {
+            // a query that's too expensive for one worker will always be.
+            if (status != NET_STATUS_TOO_EXPENSIVE) {
+                status = worker_status;
+            }
+            continue;
+        }
+        worker_missing_keys[i] = workers[i]->read_uint32();
+    }
+    net.write_uint32(status);
+    if (status != NET_STATUS_OK) {
+        session_log(session, "rejected by a worker");
+        net.flush();
+        return;
+    }
+    uint32_t missing_keys = 0;
+    for (uint32_t worker_missing : worker_missing_keys) {
+        missing_keys |= worker_missing;
+    }
+    net.write_uint32(missing_keys);
+
+    if (missing_keys & NET_SEND_PUBLIC_KEY) {
+        session_log(session, "passing on public key");
+        PublicKey public_key;
+        net.read_public_key(public_key, nullptr, max_key_message_size(cost.public_key_bytes));
+        for (size_t i = 0; i < worker_count; i++) {
+            if (worker_missing_keys[i] & NET_SEND_PUBLIC_KEY) {
+                workers[i]->write_public_key(public_key);
+            }
+        }
+    }
+
+    vector<Ciphertext> receiver_inputs;
+    Ciphertext result;
+    size_t query_count = 0;
+    while (true) {
+        uint32_t request_id;
+        uint32_t frame = net.read_frame_header(request_id);
+        for (auto &worker : workers) {
+            worker->write_frame_header(frame, request_id);
+            worker->flush();
+        }
+        if (frame == NET_FRAME_END) {
+            break;
+        }
+        if (frame != NET_FRAME_QUERY) {
+            throw invalid_argument("expected a query, got frame " + to_string(frame));
+        }
+
+        // every window is passed on to all of the workers as soon as it
+        // arrives, so they can all start computing its powers right away. the
+        // query is checked like the workers check it, so that a malformed one
+        // doesn't reach them.
+        size_t window_count = net.read_ciphertexts_start();
+        if (window_count != params.windowing().ciphertext_count()) {
+            throw invalid_argument("expected " + to_string(params.windowing().ciphertext_count())
+                                   + " windows, got " + to_string(window_count));
+        }
+        receiver_inputs.resize(window_count);
+        for (auto &worker : workers) {
+            worker->write_ciphertexts_start(receiver_inputs.size());
+        }
+        for (size_t i = 0; i < receiver_inputs.size(); i++) {
+            net.read_ciphertext(receiver_inputs[i]);
+            check_window(params, receiver_inputs[i]);
+            for (auto &worker : workers) {
+                worker->write_ciphertext(receiver_inputs[i]);
+                worker->flush();
+            }
+        }
+
+        if ((query_count == 0) && (missing_keys & NET_SEND_RELIN_KEYS)) {
+            session_log(session, "passing on relin keys");
+            RelinKeys relin_keys;
+            net.read_relin_keys(relin_keys, nullptr, max_key_message_size(cost.relin_keys_bytes));
+            for (size_t i = 0; i < worker_count; i++) {
+                if (worker_missing_keys[i] & NET_SEND_RELIN_KEYS) {
+                    workers[i]->write_relin_keys(relin_keys);
+                    workers[i]->flush();
+                }
+            }
+        }
+
+        // the workers own consecutive ranges of partitions, so their results
+        // are passed on worker by worker, each as soon as it arrives. the
+        // workers evaluate their partitions at the same time, and each one's
+        // results wait on its socket until it's that worker's turn.
+        size_t result_count = results_per_partition(params, state.labeled);
+        net.write_frame_header(NET_FRAME_RESPONSE, request_id);
+        net.write_ciphertexts_start(result_count * params.sender_partition_count());
+        for (size_t i = 0; i < worker_count; i++) {
+            uint32_t worker_request_id;
+            uint32_t worker_frame = workers[i]->read_frame_header(worker_request_id);
+            if ((worker_frame != NET_FRAME_RESPONSE) || (worker_request_id != request_id)) {
+                throw runtime_error("worker " + state.shards[i].address + " didn't respond to the query");
+            }
+            size_t worker_result_count = result_count * state.shards[i].partition_count;
+            if (workers[i]->read_ciphertexts_start() != worker_result_count) {
+                throw runtime_error("worker " + state.shards[i].address + " sent the wrong number of results");
+            }
+            for (size_t j = 0; j < worker_result_count; j++) {
+                workers[i]->read_ciphertext(result);
+                net.write_ciphertext(result);
+                net.flush();
+            }
+        }
+        query_count++;
+    }
+
+    stringstream message;
+    message << "session ended after " << query_count << " queries";
+    session_log(session, message.str());
+}
+
+// splits the partitions as evenly as possible between the workers, sends every
+// worker its share along with the params the database depends on, and waits
+// for all of them to build their databases, which they do at the same time.
+// the workers shuffle their hash tables with AES under the same table_key, so
+// that they all end up with the same table.
+void set_up_workers(io_context &context,
+                    PSIParams &params,
+                    vector<uint64_t> &table_key,
+                    vector<WorkerShard> &shards)
+{
+    size_t partition_count = params.sender_partition_count();
+    assert(shards.size() <= partition_count);
+    vector<unique_ptr<Networking>> workers;
+    size_t first_partition = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        WorkerShard &shard = shards[i];
+        shard.first_partition = first_partition;
+        shard.partition_count = partition_count / shards.size() + ((i < partition_count % shards.size()) ? 1 : 0);
+        first_partition += shard.partition_count;
+
+        cout << "setting up worker " << shard.address << " with partitions "
+             << shard.first_partition << " to " << (first_partition - 1) << endl;
+        workers.push_back(Networking::connect_to(context, shard.address));
+        Networking &worker = *workers.back();
+        worker.write_hello();
+        worker.write_uint64s(params.seeds);
+        worker.write_uint64s(table_key);
+        worker.write_uint32(partition_count);
+        worker.write_uint32(shard.first_partition);
+        worker.write_uint32(shard.partition_count);
+        worker.flush();
+    }
+
+    for (size_t i = 0; i < shards.size(); i++) {
+        workers[i]->read_hello();
+        if (workers[i]->read_uint32() != NET_STATUS_OK) {
+            throw runtime_error("worker " + shards[i].address + " failed to set up its database");
+        }
+    }
+}
+
+// the counterpart of set_up_workers: the first connection a worker accepts is
+// the coordinator's, which tells it which partitions it owns. once its
+// database is ready, the worker answers with its hello and NET_STATUS_OK.
+void read_setup(Networking &net,
+                PSIParams &params,
+                shared_ptr<UniformRandomGenerator> &table_random,
+                size_t &first_partition,
+                size_t &partition_count)
+{
     net.read_hello();
-    cout << "waiting for set size" << endl;
-    size_t receiver_size = net.read_uint32();
-    cout << "waiting for seeds" << endl;
     vector<uint64_t> seeds;
     net.read_uint64s(seeds);
-
-    // we can now establish the PSI parameters, which creates the SEAL context,
-    // which we need to receive keys and ciphertexts
-    PSIParams params(receiver_size, inputs.size(), input_bits, poly_modulus_degree);
     params.set_seeds(seeds);
-    net.set_seal_context(params.context);
-
-    cout << "waiting for public key" << endl;
-    PublicKey receiver_pk;
-    net.read_public_key(receiver_pk);
-    cout << "waiting for relin keys" << endl;
-    RelinKeys receiver_rk;
-    net.read_relin_keys(receiver_rk);
-    cout << "waiting for inputs" << endl;
-    vector<Ciphertext> receiver_inputs;
-    net.read_ciphertexts(receiver_inputs);
-
-    cout << "computing matches" << endl;
-
-    PSISender sender(params);
-    optional<vector<uint64_t>> labels_opt = labels;
-    auto sender_matches = sender.compute_matches(
-        inputs,
-        labels_opt,
-        receiver_pk,
-        receiver_rk,
-        receiver_inputs
-    );
-
-    cout << "sending matches" << endl;
-    net.write_ciphertexts(sender_matches);
+    vector<uint64_t> table_key;
+    net.read_uint64s(table_key);
+    if (table_key.size() != 2) {
+        throw invalid_argument("the coordinator sent an invalid table key");
+    }
+    table_random = make_shared<AESRandomGenerator>(table_key[0], table_key[1]);
+    params.set_sender_partition_count(net.read_uint32());
+    first_partition = net.read_uint32();
+    partition_count = net.read_uint32();
+    cout << "owning partitions " << first_partition << " to "
+         << (first_partition + partition_count - 1) << endl;
+}
+
+// listens on a host:port address (where the host can be * for every
+// interface) or a unix:path address.
+class Listener
+{
+public:
+    Listener(io_context &context, const string &address)
+        : context(context)
+    {
+        if (is_unix_address(address)) {
+            // a socket file that's left over from an earlier run would be in
+            // the way.
+            string path = unix_address_path(address);
+            remove(path.c_str());
+            unix_acceptor.emplace(context, local::stream_protocol::endpoint(path));
+        } else {
+            string host, port;
+            split_address(address, host, port);
+            ip::tcp::endpoint endpoint(ip::tcp::v4(), stoi(port));
+            if (host != "*") {
+                ip::tcp::resolver resolver(context);
+                endpoint = *resolver.resolve(ip::tcp::v4(), host, port).begin();
+            }
+            tcp_acceptor.emplace(context);
+            tcp_acceptor->open(endpoint.protocol());
+            tcp_acceptor->set_option(ip::tcp::acceptor::reuse_address(true));
+            tcp_acceptor->bind(endpoint);
+            tcp_acceptor->listen();
+        }
+    }
+
+    /* waits for the next connection. */
+    unique_ptr<Networking> accept()
+    {
+        if (unix_acceptor) {
+            return make_unique<Networking>(unix_acceptor->accept());
+        } else {
+            return make_unique<Networking>(tcp_acceptor->accept());
+        }
+    }
+
+    /* connections are accepted asynchronously, and every session runs on its
+       own thread, which mostly waits for the network: all of the sessions'
+       computations run in the shared pool. the server runs until it's killed,
+       so the sessions can refer to everything in main. */
+    void accept_sessions(function<void(Networking &, size_t)> handle_session)
+    {
+        if (unix_acceptor) {
+            accept_sessions(unix_acceptor.value(), handle_session);
+        } else {
+            accept_sessions(tcp_acceptor.value(), handle_session);
+        }
+    }
+
+private:
+    template <typename Acceptor>
+    void accept_sessions(Acceptor &acceptor, function<void(Networking &, size_t)> handle_session)
+    {
+        auto socket = make_shared<typename Acceptor::protocol_type::socket>(context);
+        acceptor.async_accept(*socket, [this, &acceptor, handle_session, socket](
+                                           const boost::system::error_code &error) {
+            if (!error) {
+                size_t session = session_count++;
+                thread([handle_session, socket, session] {
+                    try {
+                        Networking net(move(*socket));
+                        handle_session(net, session);
+                    } catch (exception &e) {
+                        // e.g. the receiver went away in the middle of the
+                        // session, which shouldn't affect any other session.
+                        session_log(session, string("session failed: ") + e.what());
+                    }
+                }).detach();
+            }
+            accept_sessions(acceptor, handle_session);
+        });
+    }
+
+    io_context &context;
+    optional<ip::tcp::acceptor> tcp_acceptor;
+    optional<local::stream_protocol::acceptor> unix_acceptor;
+};
+
+// parses a comma-separated list, e.g. of label column widths.
+vector<size_t> parse_sizes(const string &text)
+{
+    vector<size_t> sizes;
+    stringstream stream(text);
+    string size;
+    while (getline(stream, size, ',')) {
+        sizes.push_back(stoul(size));
+    }
+    return sizes;
+}
+
+int main(int argc, char **argv)
+{
+    // the options come first.
+    string address = "*:9999";
+    DatabaseStorage storage;
+    string set_path;
+    vector<size_t> label_column_bits;
+    size_t input_bits = 32;
+    size_t poly_modulus_degree = 8192;
+    size_t thread_count = 0;
+    size_t sender_partition_count = 0;
+    while (argc >= 3) {
+        string option = argv[1];
+        if (option == "--listen") {
+            address = argv[2];
+        } else if (option == "--port") {
+            address = string("*:") + argv[2];
+        } else if (option == "--coefficients") {
+            storage.coefficients_path = argv[2];
+        } else if (option == "--table-memory") {
+            storage.table_memory = stoull(argv[2]) << 20;
+        } else if (option == "--set") {
+            set_path = argv[2];
+        } else if (option == "--label-columns") {
+            label_column_bits = parse_sizes(argv[2]);
+        } else if (option == "--input-bits") {
+            input_bits = stoul(argv[2]);
+        } else if (option == "--poly-degree") {
+            poly_modulus_degree = stoul(argv[2]);
+        } else if (option == "--threads") {
+            thread_count = stoul(argv[2]);
+        } else if (option == "--partitions") {
+            sender_partition_count = stoul(argv[2]);
+        } else {
+            break;
+        }
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    bool worker = (argc == 2) && (string(argv[1]) == "worker");
+    bool coordinator = (argc >= 3) && (string(argv[1]) == "coordinator");
+    if ((argc != 1) && !worker && !coordinator) {
+        cout << "USAGE: " << argv[0] << " [--listen address | --port port] [--coefficients path]"
+             << " [--table-memory MiB] [--set path [--label-columns bits,...]]"
+             << " [--input-bits bits] [--poly-degree 8192|16384] [--threads count]"
+             << " [--partitions count] [worker | coordinator worker_address...]" << endl;
+        cout << "addresses are host:port (the server listens on *:9999 by"
+             << " default), or unix:path for clients on the same host, which"
+             << " is faster." << endl;
+        cout << "by default, the server evaluates every query itself. a"
+             << " coordinator instead passes every query on to its workers,"
+             << " each of which evaluates a share of the partitions, and"
+             << " merges their results." << endl;
+        cout << "workers must be started first, and each of them serves one"
+             << " coordinator, which sets it up. they must all be given the"
+             << " same set and params." << endl;
+        cout << "if a path is given, the database's coefficients are kept in a"
+             << " file there, instead of in memory, and read from it for every"
+             << " query." << endl;
+        cout << "if a table memory is given, the database's hash table is"
+             << " built in slices that fit into that many MiB, through"
+             << " temporary files in /tmp." << endl;
+        cout << "the set is read from a set file (see set_file.h), whose items"
+             << " must fit into the input bits (32 by default), and which has"
+             << " one label column of the given width for every label column"
+             << " (none by default, for an unlabeled set). without one, a small"
+             << " example set is used." << endl;
+        return 1;
+    }
+
+    ThreadPool pool(thread_count);
+    vector<uint64_t> inputs;
+    vector<vector<uint64_t>> labels;
+    if (set_path.empty()) {
+        inputs = {0x01, 0x02, 0x03, 0x04, 0x07, 0x22, 0xca, 0xfe};
+        // every item has a small label, and a wide one that takes several
+        // chunks.
+        labels = {
+            {0x01, 0x01, 0x02, 0x03, 0x01, 0x02, 0x00, 0x03},
+            {0x0123456789abcdefull, 0x1111111111111111ull, 0x2222222222222222ull, 0x3333333333333333ull,
+             0x4444444444444444ull, 0x5555555555555555ull, 0x6666666666666666ull, 0xfedcba9876543210ull},
+        };
+        label_column_bits = {8, 64};
+    } else {
+        cout << "loading " << set_path << endl;
+        try {
+            load_set(set_path, input_bits, label_column_bits, pool, inputs, labels);
+        } catch (exception &e) {
+            cout << e.what() << endl;
+            return 1;
+        }
+        cout << "loaded " << inputs.size() << " items" << endl;
+    }
+    bool labeled = !label_column_bits.empty();
+
+    // the sender picks the params that its database depends on, so that one
+    // database can answer every receiver's queries.
+    PSIParams params(MAX_RECEIVER_SIZE, inputs.size(), input_bits, poly_modulus_degree);
+    // there can't be more partitions than there are rows in the hash table.
+    if (sender_partition_count == 0) {
+        sender_partition_count = min(SENDER_PARTITION_COUNT, params.sender_bucket_capacity());
+    } else if (sender_partition_count > params.sender_bucket_capacity()) {
+        cout << "there can be at most " << params.sender_bucket_capacity() << " partitions" << endl;
+        return 1;
+    }
+    params.set_sender_partition_count(sender_partition_count);
+    if (labeled) {
+        params.set_label_column_bits(label_column_bits);
+    }
+
+    io_context context;
+    Listener listener(context, address);
+
+    if (coordinator) {
+        // the coordinator only needs the params, the workers hold the database.
+        params.generate_seeds();
+        auto random = UniformRandomGeneratorFactory::default_factory()->create();
+        vector<uint64_t> table_key = {random_bits(random, 64), random_bits(random, 64)};
+        vector<WorkerShard> shards;
+        for (int i = 2; i < argc; i++) {
+            shards.push_back({argv[i], 0, 0});
+        }
+        if (shards.size() > params.sender_partition_count()) {
+            cout << "there can be at most " << params.sender_partition_count() << " workers" << endl;
+            return 1;
+        }
+        try {
+            set_up_workers(context, params, table_key, shards);
+        } catch (exception &e) {
+            cout << e.what() << endl;
+            return 1;
+        }
+
+        CoordinatorState state {params, labeled, context, shards};
+        cout << "listening" << endl;
+        listener.accept_sessions([&state](Networking &net, size_t session) {
+            coordinate(net, session, state);
+        });
+        context.run();
+        return 0;
+    }
+
+    size_t first_partition = 0;
+    size_t partition_count = 0;
+    shared_ptr<UniformRandomGenerator> table_random;
+    unique_ptr<Networking> setup;
+    if (worker) {
+        cout << "waiting for the coordinator" << endl;
+        setup = listener.accept();
+        try {
+            read_setup(*setup, params, table_random, first_partition, partition_count);
+        } catch (exception &e) {
+            cout << e.what() << endl;
+            return 1;
+        }
+    } else {
+        params.generate_seeds();
+    }
+
+    cout << "preparing database" << endl;
+    optional<vector<vector<uint64_t>>> labels_opt;
+    if (labeled) {
+        labels_opt = move(labels);
+    }
+    KeyCache<PublicKey> public_key_cache(PUBLIC_KEY_CACHE_SIZE);
+    KeyCache<RelinKeys> relin_keys_cache(RELIN_KEYS_CACHE_SIZE);
+    AdmissionControl admission_control(POWERS_MEMORY_BUDGET, MAX_QUERY_SECONDS);
+    auto database = make_shared<SenderDatabase>(
+        params, inputs, labels_opt, pool, table_random, first_partition, partition_count, storage);
+
+    // admission control estimates what every session costs from how fast
+    // this machine is. the bandwidth doesn't matter for that.
+    cout << "measuring operation timings" << endl;
+    OperationTimings timings = measure_operation_timings(params, 1e9);
+    SharedState shared {
+        params,
+        database,
+        pool,
+        public_key_cache,
+        relin_keys_cache,
+        admission_control,
+        timings,
+    };
+    if (worker) {
+        setup->write_hello();
+        setup->write_uint32(NET_STATUS_OK);
+        setup->flush();
+    }
+
+    cout << "listening" << endl;
+    listener.accept_sessions([&shared](Networking &net, size_t session) {
+        serve(net, session, shared);
+    });
+    context.run();
 }
@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "set_file.h"
+
+const char SET_FILE_MAGIC[8] = {'P', 'C', 'S', 'E', 'T', '0', '0', '1'};
+// the magic, the number of items and the number of label columns.
+const size_t SET_FILE_HEADER_SIZE = 24;
+
+// a file that is mapped into memory, read-only, for as long as the MappedFile
+// exists.
+class MappedFile
+{
+public:
+    MappedFile(const string &path)
+        : data(nullptr), size(0)
+    {
+        int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0) {
+            throw system_error(errno, generic_category(), "opening " + path);
+        }
+        struct stat status;
+        if (fstat(file, &status) < 0) {
+            int error = errno;
+            close(file);
+            throw system_error(error, generic_category(), "opening " + path);
+        }
+        size = status.st_size;
+
+        if (size > 0) {
+            void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (mapping == MAP_FAILED) {
+                int error = errno;
+                close(file);
+                throw system_error(error, generic_category(), "mapping " + path);
+            }
+            // the file is read in parallel, so all of it is needed soon.
+            madvise(mapping, size, MADV_WILLNEED);
+            data = static_cast<const char *>(mapping);
+        }
+        close(file);
+    }
+
+    ~MappedFile()
+    {
+        if (size > 0) {
+            munmap(const_cast<char *>(data), size);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data;
+    size_t size;
+};
+
+uint64_t read_uint64(const char *bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+void load_binary_set(const string &path,
+                     MappedFile &file,
+                     const vector<size_t> &label_column_bits,
+                     ThreadPool &pool,
+                     vector<uint64_t> &items,
+                     vector<vector<uint64_t>> &label_columns)
+{
+    uint64_t item_count = read_uint64(file.data + 8);
+    uint64_t column_count = read_uint64(file.data + 16);
+    if (column_count != label_column_bits.size()) {
+        throw invalid_argument(path + " has " + to_string(column_count) + " label columns, not "
+                               + to_string(label_column_bits.size()));
+    }
+    uint64_t array_count = 1 + column_count;
+    if ((item_count > (file.size - SET_FILE_HEADER_SIZE) / sizeof(uint64_t) / array_count)
+        || (SET_FILE_HEADER_SIZE + item_count * array_count * sizeof(uint64_t) != file.size)) {
+        throw invalid_argument(path + " has the wrong size for " + to_string(item_count) + " items");
+    }
+
+    // the items and the columns are copied out of the mapping in parallel.
+    items.resize(item_count);
+    label_columns.assign(column_count, vector<uint64_t>(item_count));
+    parallel_ranges(pool, item_count, [&](size_t begin, size_t end) {
+        for (size_t array = 0; array < array_count; array++) {
+            uint64_t *destination = (array == 0) ? items.data() : label_columns[array - 1].data();
+            const char *source = file.data + SET_FILE_HEADER_SIZE + array * item_count * sizeof(uint64_t);
+            memcpy(destination + begin, source + begin * sizeof(uint64_t), (end - begin) * sizeof(uint64_t));
+        }
+    });
+}
+
+bool is_blank(char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+// parses a decimal number, or a hexadecimal one with 0x in front, and moves
+// text past it. returns false if there's no number, or if it doesn't fit into
+// 64 bits.
+bool parse_number(const char *&text, const char *end, uint64_t &value)
+{
+    value = 0;
+    const char *start = text;
+    if ((end - text > 2) && (text[0] == '0') && ((text[1] == 'x') || (text[1] == 'X'))) {
+        text += 2;
+        start = text;
+        for (; text < end; text++) {
+            char c = *text;
+            uint64_t digit;
+            if ((c >= '0') && (c <= '9')) {
+                digit = c - '0';
+            } else if ((c >= 'a') && (c <= 'f')) {
+                digit = c - 'a' + 10;
+            } else if ((c >= 'A') && (c <= 'F')) {
+                digit = c - 'A' + 10;
+            } else {
+                break;
+            }
+            if (value >> 60) {
+                return false;
+            }
+            value = (value << 4) | digit;
+        }
+    } else {
+        for (; (text < end) && (*text >= '0') && (*text <= '9'); text++) {
+            uint64_t digit = *text - '0';
+            if (value > (UINT64_MAX - digit) / 10) {
+                return false;
+            }
+            value = value * 10 + digit;
+        }
+    }
+    return text > start;
+}
+
+// parses the line [text, end), which must consist of field_count numbers
+// separated by commas.
+bool parse_line(const char *text, const char *end, uint64_t *fields, size_t field_count)
+{
+    for (size_t f = 0; f < field_count; f++) {
+        while ((text < end) && is_blank(*text)) {
+            text++;
+        }
+        if (!parse_number(text, end, fields[f])) {
+            return false;
+        }
+        while ((text < end) && is_blank(*text)) {
+            text++;
+        }
+        if (f + 1 < field_count) {
+            if ((text == end) || (*text != ',')) {
+                return false;
+            }
+            text++;
+        }
+    }
+    return text == end;
+}
+
+bool is_blank_line(const char *text, const char *end)
+{
+    return all_of(text, end, is_blank);
+}
+
+// calls line(begin, end) for every line in [text, end), without its newline.
+template <typename Line>
+void for_each_line(const char *text, const char *end, Line line)
+{
+    while (text < end) {
+        const char *line_end = static_cast<const char *>(memchr(text, '\n', end - text));
+        if (line_end == nullptr) {
+            line(text, end);
+            return;
+        }
+        line(text, line_end);
+        text = line_end + 1;
+    }
+}
+
+void load_text_set(const string &path,
+                   MappedFile &file,
+                   const vector<size_t> &label_column_bits,
+                   ThreadPool &pool,
+                   vector<uint64_t> &items,
+                   vector<vector<uint64_t>> &label_columns)
+{
+    // the file is split into chunks that start at the beginning of a line.
+    // first, the items in every chunk are counted, so that every chunk knows
+    // where its items go, and then they are all parsed in parallel.
+    size_t chunk_count = max<size_t>(1, min(file.size >> 16, 4 * pool.thread_count()));
+    vector<size_t> boundaries(chunk_count + 1, file.size);
+    boundaries[0] = 0;
+    for (size_t i = 1; i < chunk_count; i++) {
+        size_t position = max(file.size * i / chunk_count, boundaries[i - 1]);
+        const void *newline = (position < file.size) ? memchr(file.data + position, '\n', file.size - position)
+                                                     : nullptr;
+        boundaries[i] = newline ? (static_cast<const char *>(newline) - file.data + 1) : file.size;
+    }
+
+    vector<size_t> line_counts(chunk_count), item_counts(chunk_count);
+    parallel_for(pool, chunk_count, [&](size_t chunk) {
+        for_each_line(file.data + boundaries[chunk], file.data + boundaries[chunk + 1],
+                      [&](const char *begin, const char *end) {
+            line_counts[chunk]++;
+            if (!is_blank_line(begin, end)) {
+                item_counts[chunk]++;
+            }
+        });
+    });
+
+    size_t item_count = 0;
+    vector<size_t> first_items(chunk_count), first_lines(chunk_count);
+    for (size_t chunk = 0, line = 1; chunk < chunk_count; chunk++) {
+        first_items[chunk] = item_count;
+        first_lines[chunk] = line;
+        item_count += item_counts[chunk];
+        line += line_counts[chunk];
+    }
+
+    size_t field_count = 1 + label_column_bits.size();
+    items.resize(item_count);
+    label_columns.assign(label_column_bits.size(), vector<uint64_t>(item_count));
+    parallel_for(pool, chunk_count, [&](size_t chunk) {
+        size_t item = first_items[chunk];
+        size_t line = first_lines[chunk];
+        vector<uint64_t> fields(field_count);
+        for_each_line(file.data + boundaries[chunk], file.data + boundaries[chunk + 1],
+                      [&](const char *begin, const char *end) {
+            if (!is_blank_line(begin, end)) {
+                if (!parse_line(begin, end, fields.data(), field_count)) {
+                    throw invalid_argument(path + ":" + to_string(line) + ": expected " + to_string(field_count)
+                                           + " numbers separated by commas");
+                }
+                items[item] = fields[0];
+                for (size_t c = 0; c < label_columns.size(); c++) {
+                    label_columns[c][item] = fields[1 + c];
+                }
+                item++;
+            }
+            line++;
+        });
+    });
+}
+
+bool fits(uint64_t value, size_t bits)
+{
+    return (bits >= 64) || (value >> bits == 0);
+}
+
+// sorting the whole set would take a while, so the items are spread over
+// buckets by their top bits, and the buckets are sorted in parallel.
+void check_unique(const string &path, const vector<uint64_t> &items, size_t input_bits, ThreadPool &pool)
+{
+    size_t bucket_bits = 0;
+    while ((bucket_bits < input_bits) && ((1ull << bucket_bits) < 4 * pool.thread_count())) {
+        bucket_bits++;
+    }
+    size_t shift = input_bits - bucket_bits;
+    auto bucket_of = [&](uint64_t item) -> size_t {
+        return (bucket_bits == 0) ? 0 : (item >> shift);
+    };
+
+    size_t bucket_count = (1ull << bucket_bits);
+    vector<size_t> bucket_starts(bucket_count + 1);
+    for (uint64_t item : items) {
+        bucket_starts[bucket_of(item) + 1]++;
+    }
+    for (size_t bucket = 0; bucket < bucket_count; bucket++) {
+        bucket_starts[bucket + 1] += bucket_starts[bucket];
+    }
+    vector<uint64_t> sorted(items.size());
+    vector<size_t> positions(bucket_starts.begin(), bucket_starts.end() - 1);
+    for (uint64_t item : items) {
+        sorted[positions[bucket_of(item)]++] = item;
+    }
+
+    parallel_for(pool, bucket_count, [&](size_t bucket) {
+        auto begin = sorted.begin() + bucket_starts[bucket];
+        auto end = sorted.begin() + bucket_starts[bucket + 1];
+        sort(begin, end);
+        auto duplicate = adjacent_find(begin, end);
+        if (duplicate != end) {
+            throw invalid_argument(path + " contains the item " + to_string(*duplicate) + " more than once");
+        }
+    });
+}
+
+void load_set(const string &path,
+              size_t input_bits,
+              const vector<size_t> &label_column_bits,
+              ThreadPool &pool,
+              vector<uint64_t> &items,
+              vector<vector<uint64_t>> &label_columns,
+              bool check_items)
+{
+    MappedFile file(path);
+    if ((file.size >= SET_FILE_HEADER_SIZE) && (memcmp(file.data, SET_FILE_MAGIC, sizeof(SET_FILE_MAGIC)) == 0)) {
+        load_binary_set(path, file, label_column_bits, pool, items, label_columns);
+    } else {
+        load_text_set(path, file, label_column_bits, pool, items, label_columns);
+    }
+    if (items.empty()) {
+        throw invalid_argument(path + " has no items");
+    }
+    if (!check_items) {
+        return;
+    }
+
+    parallel_ranges(pool, items.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (!fits(items[i], input_bits)) {
+                throw invalid_argument(path + ": the item " + to_string(items[i]) + " is wider than "
+                                       + to_string(input_bits) + " bits");
+            }
+            for (size_t c = 0; c < label_columns.size(); c++) {
+                if (!fits(label_columns[c][i], label_column_bits[c])) {
+                    throw invalid_argument(path + ": the label of " + to_string(items[i]) + " in column "
+                                           + to_string(c) + " is wider than "
+                                           + to_string(label_column_bits[c]) + " bits");
+                }
+            }
+        }
+    });
+    check_unique(path, items, input_bits, pool);
+}
+
+void save_set(const string &path, const vector<uint64_t> &items, const vector<vector<uint64_t>> &label_columns)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        throw system_error(errno, generic_category(), "creating " + path);
+    }
+
+    uint64_t header[2] = {items.size(), label_columns.size()};
+    bool written = (fwrite(SET_FILE_MAGIC, sizeof(SET_FILE_MAGIC), 1, file) == 1)
+                   && (fwrite(header, sizeof(header), 1, file) == 1)
+                   && (fwrite(items.data(), sizeof(uint64_t), items.size(), file) == items.size());
+    for (auto &column : label_columns) {
+        assert(column.size() == items.size());
+        written = written && (fwrite(column.data(), sizeof(uint64_t), column.size(), file) == column.size());
+    }
+    int error = errno;
+    if ((fclose(file) != 0) && written) {
+        written = false;
+        error = errno;
+    }
+    if (!written) {
+        throw system_error(error, generic_category(), "writing " + path);
+    }
+}
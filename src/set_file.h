@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+using namespace std;
+
+/*
+A set file holds a party's items, and for a sender, their labels. It's either
+binary or text; load_set tells them apart by the binary format's magic number.
+
+The binary format is made to be memory-mapped: the magic "PCSET001", the number
+of items n and the number of label columns k, followed by the n items and then
+the n labels of each column in turn, all of them 64-bit little-endian integers
+(so, like SEAL's serialization, it's only portable between little-endian
+hosts).
+
+The text format has one item per line, followed by its labels, separated by
+commas, e.g. "1234,0x1f,7". Numbers are decimal, or hexadecimal if they start
+with 0x. Whitespace around numbers and empty lines are ignored.
+
+Both are loaded in parallel, so that sets of tens of millions of items take
+seconds.
+*/
+
+/* loads a set from path, in the pool. there must be one label column for every
+   entry of label_column_bits, and every label must fit into that many bits.
+   throws invalid_argument if the file doesn't look like that, if an item
+   doesn't fit into input_bits bits, or if an item appears more than once, and
+   system_error if it can't be read. checking the items takes longer than
+   loading a binary file, so a file that save_set wrote from items that were
+   already checked can be loaded with check_items = false. */
+void load_set(const string &path,
+              size_t input_bits,
+              const vector<size_t> &label_column_bits,
+              ThreadPool &pool,
+              vector<uint64_t> &items,
+              vector<vector<uint64_t>> &label_columns,
+              bool check_items = true);
+
+/* writes a set to path in the binary format. */
+void save_set(const string &path, const vector<uint64_t> &items, const vector<vector<uint64_t>> &label_columns);
@@ -0,0 +1,104 @@
+#include <cassert>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "boost/system/system_error.hpp"
+
+#include "shared_memory.h"
+
+// throws the error that the last system call failed with.
+void throw_system_error(const char *what)
+{
+    throw boost::system::system_error(
+        boost::system::error_code(errno, boost::system::system_category()), what);
+}
+
+unique_ptr<SharedMemoryRing> SharedMemoryRing::create(size_t capacity)
+{
+    int file = memfd_create("pc_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (file < 0) {
+        throw_system_error("memfd_create");
+    }
+    // the pages are only allocated once they're first written.
+    if ((ftruncate(file, sizeof(Header) + capacity) != 0)
+        || (fcntl(file, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)) {
+        close(file);
+        throw_system_error("memfd");
+    }
+    unique_ptr<SharedMemoryRing> ring(new SharedMemoryRing(file, capacity));
+    new (ring->header) Header();
+    ring->header->released.store(0);
+    return ring;
+}
+
+unique_ptr<SharedMemoryRing> SharedMemoryRing::open(int fd)
+{
+    // if the file could still shrink, accessing the mapping could crash us.
+    int seals = fcntl(fd, F_GET_SEALS);
+    struct stat status;
+    if ((seals < 0) || !(seals & F_SEAL_SHRINK) || (fstat(fd, &status) != 0)
+        || (static_cast<size_t>(status.st_size) <= sizeof(Header))) {
+        close(fd);
+        throw boost::system::system_error(
+            boost::system::errc::make_error_code(boost::system::errc::invalid_argument),
+            "shared memory ring");
+    }
+    return unique_ptr<SharedMemoryRing>(new SharedMemoryRing(fd, status.st_size - sizeof(Header)));
+}
+
+SharedMemoryRing::SharedMemoryRing(int file, size_t capacity)
+    : file(file), capacity(capacity), head(0)
+{
+    void *mapping = mmap(nullptr, sizeof(Header) + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (mapping == MAP_FAILED) {
+        close(file);
+        throw_system_error("mmap");
+    }
+    header = static_cast<Header *>(mapping);
+    data = static_cast<uint8_t *>(mapping) + sizeof(Header);
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+    munmap(header, sizeof(Header) + capacity);
+    close(file);
+}
+
+int SharedMemoryRing::fd()
+{
+    return file;
+}
+
+uint8_t *SharedMemoryRing::allocate(size_t byte_count, uint64_t &position)
+{
+    // skip the rest of the ring if the bytes don't fit in front of its end.
+    uint64_t start = head;
+    size_t offset = start % capacity;
+    if (offset + byte_count > capacity) {
+        start += capacity - offset;
+    }
+    if (start + byte_count - header->released.load(memory_order_acquire) > capacity) {
+        return nullptr;
+    }
+    head = start + byte_count;
+    position = start;
+    return data + start % capacity;
+}
+
+const uint8_t *SharedMemoryRing::at(uint64_t position, size_t byte_count)
+{
+    // the position comes from the other side.
+    if ((byte_count > capacity) || (position % capacity > capacity - byte_count)) {
+        throw invalid_argument("position outside of the shared memory ring");
+    }
+    return data + position % capacity;
+}
+
+void SharedMemoryRing::release(uint64_t end_position)
+{
+    header->released.store(end_position, memory_order_release);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+using namespace std;
+
+/*
+SharedMemoryRing is a ring buffer in memory that two processes on the same host
+share, which one of them writes to and the other reads from, so that bulk data
+can be handed over without going through the kernel. It's backed by an
+anonymous memory file, whose file descriptor the writer passes to the reader
+(see Networking).
+
+The writer allocates space in the ring, fills it, and tells the reader its
+position out of band. The reader releases everything up to the end of what it
+has read, in the same order as it was written, which lets the writer reuse that
+space. Positions only ever increase; a position's offset in the ring is the
+position modulo the capacity, and allocations never wrap around the end.
+
+The file is sealed against changing its size before it's passed on, so that the
+reader can rely on the mapping staying valid even if it doesn't trust the
+writer.
+*/
+
+class SharedMemoryRing
+{
+public:
+    /* creates a new ring with room for capacity bytes, for writing. */
+    static unique_ptr<SharedMemoryRing> create(size_t capacity);
+    /* maps the ring that the other side created, for reading. takes ownership
+       of fd. */
+    static unique_ptr<SharedMemoryRing> open(int fd);
+    ~SharedMemoryRing();
+
+    SharedMemoryRing(const SharedMemoryRing &) = delete;
+    SharedMemoryRing &operator=(const SharedMemoryRing &) = delete;
+
+    int fd();
+
+    /* returns where to write byte_count bytes, and sets position to their
+       position, or returns nullptr if they don't fit right now. */
+    uint8_t *allocate(size_t byte_count, uint64_t &position);
+
+    /* the byte_count bytes at position. throws invalid_argument if they don't
+       lie within the ring. */
+    const uint8_t *at(uint64_t position, size_t byte_count);
+    /* everything before end_position has been read. */
+    void release(uint64_t end_position);
+
+private:
+    SharedMemoryRing(int file, size_t capacity);
+
+    // the only state that both sides write is the released position. it has
+    // its own cache line, in front of the data.
+    struct Header
+    {
+        alignas(64) atomic<uint64_t> released;
+    };
+
+    int file;
+    size_t capacity;
+    Header *header;
+    uint8_t *data;
+    // the position of the next allocation, which only the writer knows.
+    uint64_t head;
+};
@@ -1,5 +1,12 @@
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <numeric>
 #include <set>
+#include <sstream>
+#include <system_error>
 
+#include "set_file.h"
 #include "test_utils.h"
 
 void generate_random_sender_set(shared_ptr<UniformRandomGenerator> random,
@@ -50,3 +57,130 @@ void generate_random_receiver_set(shared_ptr<UniformRandomGenerator> random,
         swap(inputs[j], inputs[k]);
     }
 }
+
+// the number of values that are permuted or encrypted at a time.
+const size_t DATASET_BLOCK_SIZE = 4096;
+
+// sets results[i] to first + i under the permutation, for every i < count.
+void permute_sequence(AESPermutation &permutation, uint64_t first, size_t count, uint64_t *results, ThreadPool &pool)
+{
+    parallel_ranges(pool, count, [&](size_t begin, size_t end) {
+        // every thread needs its own AES.
+        AESPermutation local_permutation = permutation;
+        vector<uint64_t> values(DATASET_BLOCK_SIZE);
+        for (size_t block = begin; block < end; block += DATASET_BLOCK_SIZE) {
+            size_t block_count = min(DATASET_BLOCK_SIZE, end - block);
+            iota(values.begin(), values.begin() + block_count, first + block);
+            local_permutation.permute(values.data(), block_count, results + block);
+        }
+    });
+}
+
+void generate_dataset(uint64_t seed,
+                      size_t input_bits,
+                      size_t sender_size,
+                      size_t receiver_size,
+                      size_t match_percent,
+                      size_t label_columns,
+                      size_t label_bits,
+                      ThreadPool &pool,
+                      Dataset &dataset)
+{
+    size_t match_count = (receiver_size * match_percent) / 100;
+    size_t other_count = receiver_size - match_count;
+    assert(match_count <= sender_size);
+    assert((input_bits == 64) || (sender_size + other_count <= (1ull << input_bits)));
+
+    // every part of the dataset is derived from the seed with its own key.
+    AESPermutation inputs_permutation(seed, 0, input_bits);
+    dataset.sender_inputs.resize(sender_size);
+    permute_sequence(inputs_permutation, 0, sender_size, dataset.sender_inputs.data(), pool);
+
+    // the label of input i in column c is the encryption of (c, i).
+    AES labels_aes;
+    labels_aes.set_key(seed, 1);
+    uint64_t label_mask = (label_bits == 64) ? ~0ull : ((1ull << label_bits) - 1);
+    dataset.sender_labels.assign(label_columns, vector<uint64_t>(sender_size));
+    parallel_ranges(pool, sender_size, [&](size_t begin, size_t end) {
+        AES aes = labels_aes;
+        vector<uint64_t> indices(DATASET_BLOCK_SIZE);
+        for (size_t block = begin; block < end; block += DATASET_BLOCK_SIZE) {
+            size_t block_count = min(DATASET_BLOCK_SIZE, end - block);
+            iota(indices.begin(), indices.begin() + block_count, block);
+            for (size_t c = 0; c < label_columns; c++) {
+                uint64_t *labels = &dataset.sender_labels[c][block];
+                aes.encrypt_low(c, indices.data(), block_count, labels);
+                for (size_t i = 0; i < block_count; i++) {
+                    labels[i] &= label_mask;
+                }
+            }
+        }
+    });
+
+    // the matches are the sender's inputs at distinct random indices, which
+    // another permutation picks, walking over the indices that are too big.
+    dataset.receiver_inputs.resize(receiver_size);
+    size_t index_bits = 1;
+    while ((1ull << index_bits) < sender_size) {
+        index_bits++;
+    }
+    AESPermutation indices_permutation(seed, 2, index_bits);
+    for (size_t i = 0; i < match_count; i++) {
+        uint64_t index = i;
+        do {
+            indices_permutation.permute(&index, 1, &index);
+        } while (index >= sender_size);
+        dataset.receiver_inputs[i] = dataset.sender_inputs[index];
+    }
+    // the rest come right after the sender's inputs, so they can't match.
+    permute_sequence(inputs_permutation, sender_size, other_count, dataset.receiver_inputs.data() + match_count, pool);
+
+    // shuffle to make sure the matches aren't all in the beginning
+    auto random = make_shared<AESRandomGenerator>(seed, 3);
+    for (size_t j = 1; j < receiver_size; j++) {
+        size_t k = random_integer(random, j + 1);
+        swap(dataset.receiver_inputs[j], dataset.receiver_inputs[k]);
+    }
+}
+
+void load_dataset(const string &cache_directory,
+                  uint64_t seed,
+                  size_t input_bits,
+                  size_t sender_size,
+                  size_t receiver_size,
+                  size_t match_percent,
+                  size_t label_columns,
+                  size_t label_bits,
+                  ThreadPool &pool,
+                  Dataset &dataset)
+{
+    stringstream name;
+    name << cache_directory << "/dataset-" << seed << "-" << input_bits << "-" << sender_size << "-"
+         << receiver_size << "-" << match_percent << "-" << label_columns << "x" << label_bits;
+    string sender_path = name.str() + "-sender.set";
+    string receiver_path = name.str() + "-receiver.set";
+
+    try {
+        vector<vector<uint64_t>> no_labels;
+        // generate_dataset's items are distinct by construction.
+        load_set(sender_path, input_bits, vector<size_t>(label_columns, label_bits), pool,
+                 dataset.sender_inputs, dataset.sender_labels, false);
+        load_set(receiver_path, input_bits, {}, pool, dataset.receiver_inputs, no_labels, false);
+        if ((dataset.sender_inputs.size() == sender_size) && (dataset.receiver_inputs.size() == receiver_size)) {
+            return;
+        }
+    } catch (system_error &) {
+        // it hasn't been generated yet.
+    }
+
+    // the files are only renamed into place once they're complete, so that a
+    // run that's interrupted doesn't leave a broken dataset behind.
+    generate_dataset(seed, input_bits, sender_size, receiver_size, match_percent, label_columns, label_bits,
+                     pool, dataset);
+    save_set(sender_path + ".tmp", dataset.sender_inputs, dataset.sender_labels);
+    save_set(receiver_path + ".tmp", dataset.receiver_inputs, {});
+    if ((rename((sender_path + ".tmp").c_str(), sender_path.c_str()) != 0)
+        || (rename((receiver_path + ".tmp").c_str(), receiver_path.c_str()) != 0)) {
+        throw system_error(errno, generic_category(), "saving " + name.str());
+    }
+}
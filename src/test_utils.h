@@ -1,6 +1,8 @@
+#include <string>
 #include <vector>
 
 #include "random.h"
+#include "thread_pool.h"
 
 void generate_random_sender_set(shared_ptr<UniformRandomGenerator> random,
                                 vector<uint64_t> &inputs,
@@ -15,3 +17,42 @@ void generate_random_receiver_set(shared_ptr<UniformRandomGenerator> random,
                                   vector<uint64_t> &sender_inputs,
                                   size_t bits,
                                   uint64_t match_prob_percent);
+
+/* the sets of a benchmark run. */
+struct Dataset
+{
+    vector<uint64_t> sender_inputs;
+    // every column has a label of label_bits bits for every sender input.
+    vector<vector<uint64_t>> sender_labels;
+    vector<uint64_t> receiver_inputs;
+};
+
+/* generates a dataset that only depends on the seed and the sizes, in the
+   pool. the inputs are distinct by construction: input i is i under an
+   AESPermutation of input_bits bits. the sender gets the first sender_size of
+   them, and exactly receiver_size * match_percent / 100 of the receiver's
+   inputs are picked from the sender's, the rest being the ones after the
+   sender's, in a random order. */
+void generate_dataset(uint64_t seed,
+                      size_t input_bits,
+                      size_t sender_size,
+                      size_t receiver_size,
+                      size_t match_percent,
+                      size_t label_columns,
+                      size_t label_bits,
+                      ThreadPool &pool,
+                      Dataset &dataset);
+
+/* like generate_dataset, but keeps the dataset in two set files in
+   cache_directory, named after the arguments, and loads it from there if it's
+   already been generated. */
+void load_dataset(const string &cache_directory,
+                  uint64_t seed,
+                  size_t input_bits,
+                  size_t sender_size,
+                  size_t receiver_size,
+                  size_t match_percent,
+                  size_t label_columns,
+                  size_t label_bits,
+                  ThreadPool &pool,
+                  Dataset &dataset);
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cassert>
+
+#include "thread_pool.h"
+
+// states of the tasks in parallel_for_in_order
+const uint8_t TASK_PENDING = 0;
+const uint8_t TASK_DONE = 1;
+const uint8_t TASK_FAILED = 2;
+
+// the deadline of the task that's running on this thread, or the one set by a
+// TaskDeadline.
+thread_local bool has_current_deadline = false;
+thread_local deadline_type current_deadline;
+
+ThreadPool::ThreadPool(size_t thread_count)
+    : submitted(0), stopping(false)
+{
+    if (thread_count == 0) {
+        thread_count = thread::hardware_concurrency();
+    }
+    if (thread_count == 0) {
+        // hardware_concurrency() is allowed to return 0 if it doesn't know.
+        thread_count = 1;
+    }
+
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back(&ThreadPool::worker, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(tasks_mutex);
+        stopping = true;
+    }
+    tasks_available.notify_all();
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    deadline_type deadline = has_current_deadline ? current_deadline : chrono::steady_clock::now();
+    {
+        lock_guard<mutex> lock(tasks_mutex);
+        assert(!stopping);
+        tasks.push_back({deadline, submitted++, move(task)});
+        push_heap(tasks.begin(), tasks.end(), runs_later);
+    }
+    tasks_available.notify_one();
+}
+
+bool ThreadPool::runs_later(const QueuedTask &a, const QueuedTask &b)
+{
+    if (a.deadline != b.deadline) {
+        return a.deadline > b.deadline;
+    }
+    return a.sequence > b.sequence;
+}
+
+ThreadPool::QueuedTask ThreadPool::pop_task()
+{
+    pop_heap(tasks.begin(), tasks.end(), runs_later);
+    QueuedTask task = move(tasks.back());
+    tasks.pop_back();
+    return task;
+}
+
+void ThreadPool::run_task(QueuedTask &task)
+{
+    bool had_previous = has_current_deadline;
+    deadline_type previous = current_deadline;
+    has_current_deadline = true;
+    current_deadline = task.deadline;
+    // TaskGroup catches all exceptions, so this always returns.
+    task.task();
+    has_current_deadline = had_previous;
+    current_deadline = previous;
+}
+
+size_t ThreadPool::thread_count()
+{
+    return threads.size();
+}
+
+bool ThreadPool::run_pending_task()
+{
+    QueuedTask task;
+    {
+        lock_guard<mutex> lock(tasks_mutex);
+        if (tasks.empty()) {
+            return false;
+        }
+        task = pop_task();
+    }
+    run_task(task);
+    return true;
+}
+
+void ThreadPool::worker()
+{
+    while (true) {
+        QueuedTask task;
+        {
+            unique_lock<mutex> lock(tasks_mutex);
+            tasks_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                // we only get here if we're stopping and there's nothing left
+                // to do.
+                return;
+            }
+            task = pop_task();
+        }
+        run_task(task);
+    }
+}
+
+
+TaskDeadline::TaskDeadline(deadline_type deadline)
+    : previous(current_deadline), had_previous(has_current_deadline)
+{
+    has_current_deadline = true;
+    current_deadline = deadline;
+}
+
+TaskDeadline::~TaskDeadline()
+{
+    has_current_deadline = had_previous;
+    current_deadline = previous;
+}
+
+TaskGroup::TaskGroup(ThreadPool &pool)
+    : pool(pool), pending(0), submitted(0)
+{}
+
+TaskGroup::~TaskGroup()
+{
+    wait_for_tasks();
+}
+
+void TaskGroup::run(function<void()> task)
+{
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        pending++;
+    }
+
+    pool.submit([this, task = move(task)] {
+        exception_ptr task_error;
+        try {
+            task();
+        } catch (...) {
+            task_error = current_exception();
+        }
+
+        lock_guard<mutex> lock(pending_mutex);
+        if (task_error && !error) {
+            error = task_error;
+        }
+        pending--;
+        if (pending == 0) {
+            done.notify_all();
+        }
+    });
+
+    // only announce the task once it is actually in the pool's queue, so that
+    // a waiting thread that wakes up because of it is able to pick it up.
+    lock_guard<mutex> lock(pending_mutex);
+    submitted++;
+    done.notify_all();
+}
+
+void TaskGroup::wait()
+{
+    wait_for_tasks();
+
+    lock_guard<mutex> lock(pending_mutex);
+    if (error) {
+        exception_ptr to_throw = error;
+        error = nullptr;
+        rethrow_exception(to_throw);
+    }
+}
+
+void TaskGroup::wait_for_tasks()
+{
+    unique_lock<mutex> lock(pending_mutex);
+    while (pending > 0) {
+        // instead of just blocking, help out with whatever is queued. this
+        // prevents deadlocks when every worker is waiting on some group.
+        size_t seen_submitted = submitted;
+        lock.unlock();
+        bool ran = pool.run_pending_task();
+        lock.lock();
+        if (!ran) {
+            done.wait(lock, [&] {
+                return (pending == 0) || (submitted != seen_submitted);
+            });
+        }
+    }
+}
+
+
+void parallel_for(ThreadPool &pool, size_t count, function<void(size_t)> body)
+{
+    TaskGroup group(pool);
+    for (size_t i = 0; i < count; i++) {
+        group.run([&body, i] { body(i); });
+    }
+    group.wait();
+}
+
+void parallel_ranges(ThreadPool &pool, size_t count, function<void(size_t, size_t)> body)
+{
+    size_t range_count = min(count, 4 * pool.thread_count());
+    parallel_for(pool, range_count, [&](size_t range) {
+        body(count * range / range_count, count * (range + 1) / range_count);
+    });
+}
+
+void parallel_for_in_order(ThreadPool &pool,
+                           size_t count,
+                           function<void(size_t)> body,
+                           function<void(size_t)> on_done)
+{
+    // state[i] becomes TASK_DONE (or TASK_FAILED) once body(i) is over.
+    vector<uint8_t> state(count, TASK_PENDING);
+    mutex state_mutex;
+    condition_variable state_changed;
+    auto set_state = [&](size_t i, uint8_t new_state) {
+        lock_guard<mutex> lock(state_mutex);
+        state[i] = new_state;
+        state_changed.notify_all();
+    };
+
+    TaskGroup group(pool);
+    for (size_t i = 0; i < count; i++) {
+        group.run([&, i] {
+            try {
+                body(i);
+            } catch (...) {
+                set_state(i, TASK_FAILED);
+                throw;
+            }
+            set_state(i, TASK_DONE);
+        });
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        unique_lock<mutex> lock(state_mutex);
+        state_changed.wait(lock, [&] { return state[i] != TASK_PENDING; });
+        if (state[i] == TASK_FAILED) {
+            // group.wait() will rethrow the error.
+            break;
+        }
+        lock.unlock();
+        on_done(i);
+    }
+
+    group.wait();
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef chrono::steady_clock::time_point deadline_type;
+
+/*
+ThreadPool is a fixed-size pool of worker threads that execute tasks in the
+order of their deadlines, earliest first, and tasks with the same deadline in
+the order in which they were submitted.
+
+A task's deadline is that of whoever submitted it: within a task, the task's
+own deadline, and elsewhere the one set by the innermost TaskDeadline on the
+submitting thread. Without one, a task's deadline is the time at which it was
+submitted, so tasks without deadlines are run first come, first served, and
+tasks with a far-off deadline still get their turn eventually. In particular,
+all the tasks that some computation spawns share its deadline, so work with
+an earlier deadline overtakes the remaining work of computations with later
+ones.
+
+Tasks are usually not submitted to the pool directly, but through a TaskGroup,
+which makes it possible to wait for a particular set of tasks to complete (and
+to rethrow any exception that one of them raised) while other, unrelated tasks
+keep running in the same pool.
+*/
+
+class ThreadPool
+{
+public:
+    /* thread_count = 0 means one thread per hardware thread. */
+    ThreadPool(size_t thread_count = 0);
+    ~ThreadPool();
+
+    void submit(function<void()> task);
+    size_t thread_count();
+
+    /* runs one pending task on the calling thread, if there is one. returns
+       whether a task was run. */
+    bool run_pending_task();
+
+private:
+    struct QueuedTask
+    {
+        deadline_type deadline;
+        uint64_t sequence;
+        function<void()> task;
+    };
+
+    /* the heap's order: the task with the earliest deadline (and then the
+       lowest sequence number) ends up on top. */
+    static bool runs_later(const QueuedTask &a, const QueuedTask &b);
+    void worker();
+    /* takes the task with the earliest deadline out of the queue. */
+    QueuedTask pop_task();
+    /* runs a task with the task's deadline in effect. */
+    void run_task(QueuedTask &task);
+
+    vector<thread> threads;
+    // a heap, ordered by deadline and then by sequence number.
+    vector<QueuedTask> tasks;
+    uint64_t submitted;
+    mutex tasks_mutex;
+    condition_variable tasks_available;
+    bool stopping;
+};
+
+/* sets the deadline of every task that the current thread submits (directly or
+   through a TaskGroup, parallel_for, etc.) while the TaskDeadline exists. */
+class TaskDeadline
+{
+public:
+    TaskDeadline(deadline_type deadline);
+    ~TaskDeadline();
+
+private:
+    deadline_type previous;
+    bool had_previous;
+};
+
+class TaskGroup
+{
+public:
+    TaskGroup(ThreadPool &pool);
+    /* NB: the destructor waits for all of the group's tasks. */
+    ~TaskGroup();
+
+    /* may also be called from within a task of this group. */
+    void run(function<void()> task);
+    /* waits for all tasks of the group (including ones submitted while
+       waiting) and rethrows the first exception raised by any of them.
+       while waiting, the calling thread helps execute pending tasks, so it is
+       safe to wait on a group from within a task running in the same pool. */
+    void wait();
+
+private:
+    void wait_for_tasks();
+
+    ThreadPool &pool;
+    size_t pending;
+    size_t submitted;
+    exception_ptr error;
+    mutex pending_mutex;
+    condition_variable done;
+};
+
+/* calls body(i) for each 0 <= i < count, spreading the calls over the pool,
+   and returns once all of them have completed. */
+void parallel_for(ThreadPool &pool, size_t count, function<void(size_t)> body);
+
+/* calls body(begin, end) for a few ranges per thread that together cover
+   0 <= i < count, for loops whose iterations are too cheap to be tasks. */
+void parallel_ranges(ThreadPool &pool, size_t count, function<void(size_t, size_t)> body);
+
+/* like parallel_for, but also calls on_done(i) on the calling thread for each
+   i in order, as soon as body(i) (and every body before it) has completed, e.g.
+   to send each result while the later ones are still being computed. */
+void parallel_for_in_order(ThreadPool &pool,
+                           size_t count,
+                           function<void(size_t)> body,
+                           function<void(size_t)> on_done);
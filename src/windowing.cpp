@@ -1,5 +1,7 @@
+#include <atomic>
 #include <cassert>
 
+#include "memory_pools.h"
 #include "polynomials.h"
 
 #include "windowing.h"
@@ -8,120 +10,171 @@
 // - figure out if there are any off-by-one errors that cause us to output more
 //   powers than necessary
 // - figure out if it's worth outputting fewer powers in the last window
-// - optimize the early exits in compute_powers
 
 Windowing::Windowing(size_t window_size, size_t max_power)
-    : window_size(window_size), max_power(max_power)
+    : max_power(max_power)
 {
     if (window_size > 0) {
         // TODO: evaluate if the performance benefit of adding one extra element
         // to each window (and using bit shifts to index into arrays) is worth
         // the memory/communication overhead.
-        window_width = (1ull << window_size) - 1;
-        window_count = 1;
+        size_t window_width = (1ull << window_size) - 1;
+        size_t window_count = 1;
         // `window_count` is the first `i` such that
         // `i > floor(log2(max_power + 1) / window_size)`
         while ((1ull << (window_count * window_size)) <= max_power) {
             window_count++;
         }
+
+        // the last window's larger sources are never needed: every power up to
+        // max_power only uses sources up to itself.
+        for (size_t i = 0; i < window_count; i++) {
+            for (size_t j = 1; j <= window_width; j++) {
+                if ((j << (window_size * i)) <= max_power) {
+                    sources.push_back(j << (window_size * i));
+                }
+            }
+        }
+    } else {
+        sources.push_back(1);
     }
+
+    dag_ = PowersDag(sources, max_power);
 }
 
+Windowing::Windowing(vector<uint64_t> &sources, size_t max_power)
+    : max_power(max_power), sources(sources), dag_(sources, max_power)
+{}
+
 void Windowing::prepare(vector<uint64_t> &input,
                         vector<Ciphertext> &windows,
                         uint64_t modulus,
                         BatchEncoder &encoder,
-                        Encryptor &encryptor)
+                        Encryptor &encryptor,
+                        ZeroPool *zeros,
+                        ThreadPool &pool,
+                        function<void(size_t, Ciphertext &)> on_window_ready)
 {
-    Plaintext encoded;
-
-    if (window_size == 0) {
-        windows.resize(1);
-        encoder.encode(input, encoded);
-        encryptor.encrypt(encoded, windows[0]);
-        return;
-    }
+    windows.resize(sources.size());
 
-    windows.resize(window_width * window_count);
-
-    vector<uint64_t> input_mul;
-    for (size_t i = 0; i < window_count; i++) {
-        // throughout this loop, we maintain the following invariant
-        // (where y denotes the initial input):
-        // input = y^{2^{l * i}}
-        // input_mul = y^{2^{l * i} * j}
-        input_mul = input;
-        for (size_t j = 1; j <= window_width; j++) {
-            encoder.encode(input_mul, encoded);
-            encryptor.encrypt(
-                encoded,
-                windows[i * window_width + j - 1]
-            );
-
-            if (j <= window_width - 1) {
-                // multiply input_mul by input for next iteration.
-                for (size_t k = 0; k < input.size(); k++) {
-                    input_mul[k] = MUL_MOD(input_mul[k], input[k], modulus);
-                }
-            }
+    // every window is exponentiated, encoded and encrypted by its own task.
+    // the buffers are reused by every window the thread encrypts.
+    auto encrypt_window = [&](size_t i) {
+        thread_local vector<uint64_t> input_pow;
+        thread_local Plaintext encoded(thread_memory_pool());
+        input_pow.resize(input.size());
+        for (size_t k = 0; k < input.size(); k++) {
+            input_pow[k] = modexp(input[k], sources[i], modulus);
         }
-
-        if (i < window_count - 1) {
-            // take input to the 2^l power for next iteration.
-            for (size_t k = 0; k < input.size(); k++) {
-                input[k] = modexp(input[k], 1ull << window_size, modulus);
-            }
+        encoder.encode(input_pow, encoded);
+        if (zeros) {
+            zeros->encrypt(encoded, windows[i]);
+        } else {
+            encryptor.encrypt(encoded, windows[i], thread_memory_pool());
         }
+    };
+
+    if (on_window_ready) {
+        // hand the windows over in order, each one as soon as it's done.
+        parallel_for_in_order(pool, sources.size(), encrypt_window, [&](size_t i) {
+            on_window_ready(i, windows[i]);
+        });
+    } else {
+        parallel_for(pool, sources.size(), encrypt_window);
     }
 }
 
 void Windowing::compute_powers(vector<Ciphertext> &windows,
                                vector<Ciphertext> &powers,
                                Evaluator &evaluator,
-                               RelinKeys &relin_keys)
+                               const RelinKeys &relin_keys,
+                               ThreadPool &pool)
 {
-    if (window_size == 0) {
-        assert(windows.size() == 1);
-        powers[1] = windows[0];
-        for (size_t i = 2; i < powers.size(); i++) {
-            if (i & 2 == 0) {
-                evaluator.square(powers[i >> 1], powers[i]);
-            } else {
-                evaluator.multiply(powers[i - 1], powers[1], powers[i]);
-            }
-            evaluator.relinearize_inplace(powers[i], relin_keys);
-        }
-    } else {
-        assert(windows.size() == window_width * window_count);
-        // the first 2^l - 1 powers are directly copied over
-        for (size_t i = 1; i <= window_width; i++) {
-            if (i >= powers.size()) {
-                return;
-            }
-            powers[i] = windows[i - 1];
+    assert(windows.size() == sources.size());
+
+    PowersComputation computation(*this, powers, evaluator, relin_keys, pool);
+    for (size_t i = 0; i < windows.size(); i++) {
+        computation.add_window(i, windows[i]);
+    }
+    computation.wait();
+}
+
+PowersDag &Windowing::dag()
+{
+    return dag_;
+}
+
+size_t Windowing::ciphertext_count()
+{
+    return sources.size();
+}
+
+vector<uint64_t> &Windowing::source_powers()
+{
+    return sources;
+}
+
+PowersComputation::PowersComputation(Windowing &windowing,
+                                     vector<Ciphertext> &powers,
+                                     Evaluator &evaluator,
+                                     const RelinKeys &relin_keys,
+                                     ThreadPool &pool)
+    : windowing(windowing),
+      powers(powers),
+      evaluator(evaluator),
+      relin_keys(relin_keys),
+      pending_factors(powers.size()),
+      windows_added(0),
+      group(pool)
+{
+    assert(powers.size() <= windowing.max_power + 1);
+
+    // every non-source power is computed by its own task, which is started as
+    // soon as both of its factors are available.
+    for (size_t n = 1; n < powers.size(); n++) {
+        if (!windowing.dag_.is_source(n)) {
+            auto factors = windowing.dag_.factors(n);
+            pending_factors[n] = (factors.first == factors.second) ? 1 : 2;
         }
+    }
+}
 
-        for (size_t i = 1; i < window_count; i++) {
-            for (size_t j = 1; j <= window_width; j++) {
-                // now, for each new window i, we go over all of its elements
-                // j (encoding y^{2^{l * i} * j}) and compute every power of the
-                // form y^{2^{l * i} * j + k}, where k < 2^{l * i} (equivalently,
-                // y^k was computed before we started working on window i).
-                size_t high_bits = (j << (window_size * i));
-                if (high_bits >= powers.size()) {
-                    break;
-                }
-                powers[high_bits] = windows[i * window_width + j - 1];
-                for (size_t low_bits = 1; low_bits < (1ull << (window_size * i)); low_bits++) {
-                    size_t new_power = high_bits | low_bits;
-                    if (new_power >= powers.size()) {
-                        // TODO: figure out if there's a smarter way to break here.
-                        break;
-                    }
-                    evaluator.multiply(powers[low_bits], powers[high_bits], powers[new_power]);
-                    evaluator.relinearize_inplace(powers[new_power], relin_keys);
-                }
-            }
+void PowersComputation::add_window(size_t index, const Ciphertext &window)
+{
+    assert(index < windowing.sources.size());
+    windows_added++;
+
+    // the source powers are directly copied over
+    uint64_t source = windowing.sources[index];
+    if (source < powers.size()) {
+        powers[source] = window;
+        power_ready(source);
+    }
+}
+
+void PowersComputation::wait()
+{
+    assert(windows_added == windowing.sources.size());
+    group.wait();
+}
+
+void PowersComputation::power_ready(size_t n)
+{
+    for (size_t dependent : windowing.dag_.dependents(n)) {
+        if ((dependent < powers.size()) && (--pending_factors[dependent] == 0)) {
+            group.run([this, dependent] { compute_power(dependent); });
         }
     }
 }
+
+void PowersComputation::compute_power(size_t n)
+{
+    auto factors = windowing.dag_.factors(n);
+    if (factors.first == factors.second) {
+        evaluator.square(powers[factors.first], powers[n], thread_memory_pool());
+    } else {
+        evaluator.multiply(powers[factors.first], powers[factors.second], powers[n], thread_memory_pool());
+    }
+    evaluator.relinearize_inplace(powers[n], relin_keys, thread_memory_pool());
+    power_ready(n);
+}
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <vector>
 
 #include "seal/seal.h"
 
+#include "powers_dag.h"
+#include "thread_pool.h"
+#include "zero_pool.h"
+
 using namespace std;
 using namespace seal;
 
@@ -24,27 +30,95 @@ over the values y^{2^{l * i} * j} for each 0 <= i <= ceil(log2(m) / l) and
 
 Additionally, we implement the special case l = 0 that does not use windowing
 and only sends over y.
+
+More generally, A can send over y^s for each s in an arbitrary set of *source*
+powers S, such as one computed by plan_power_basis (see powers_dag.h), which
+makes it possible to trade the number of values that A sends for the number of
+multiplications and the multiplicative depth that B needs.
+
+B computes the remaining powers by following a PowersDag, which minimizes the
+multiplicative depth of every power, and runs independent multiplications of
+the DAG in parallel.
 */
 
 class Windowing
 {
 public:
     Windowing(size_t window_size, size_t max_power);
-    /* NB: prepare will overwrite the input. */
+    /* sources must contain 1. */
+    Windowing(vector<uint64_t> &sources, size_t max_power);
+    /* the windows are encrypted in parallel. if zeros is not null, the
+       encryptions use precomputed zeros from it while there are any.
+       if on_window_ready is given, it is called (on the calling thread) with
+       each window in order, as soon as that window is ready. */
     void prepare(vector<uint64_t> &input,
                  vector<Ciphertext> &windows,
                  uint64_t modulus,
                  BatchEncoder &encoder,
-                 Encryptor &encryptor);
+                 Encryptor &encryptor,
+                 ZeroPool *zeros,
+                 ThreadPool &pool,
+                 function<void(size_t, Ciphertext &)> on_window_ready = nullptr);
     /* NB: compute_powers leaves powers[0] untouched. */
     void compute_powers(vector<Ciphertext> &windows,
                         vector<Ciphertext> &powers,
                         Evaluator &evaluator,
-                        RelinKeys &relin_keys);
+                        const RelinKeys &relin_keys,
+                        ThreadPool &pool);
+
+    PowersDag &dag();
+    /* the number of ciphertexts that prepare outputs. */
+    size_t ciphertext_count();
+    /* the power of the input in each of them, e.g. to send as a power basis. */
+    vector<uint64_t> &source_powers();
 
 private:
-    size_t window_size;
+    friend class PowersComputation;
+
     size_t max_power;
-    size_t window_width;
-    size_t window_count;
+    // sources[i] is the power of y encrypted in windows[i]
+    vector<uint64_t> sources;
+    PowersDag dag_;
+};
+
+/*
+PowersComputation computes the powers from the windows incrementally, while the
+windows are still arriving: as soon as a window is added, every power whose
+factors are now available is computed in the pool, so the multiplications
+overlap with receiving (and deserializing) the rest of the windows.
+*/
+
+class PowersComputation
+{
+public:
+    /* the powers are written to powers[1..powers.size() - 1]. all arguments
+       must outlive the computation. */
+    PowersComputation(Windowing &windowing,
+                      vector<Ciphertext> &powers,
+                      Evaluator &evaluator,
+                      const RelinKeys &relin_keys,
+                      ThreadPool &pool);
+
+    /* index is the window's index in the output of Windowing::prepare. every
+       window must be added exactly once, from one thread at a time. */
+    void add_window(size_t index, const Ciphertext &window);
+    /* waits until all powers have been computed, which requires every window
+       to have been added. */
+    void wait();
+
+private:
+    void power_ready(size_t n);
+    void compute_power(size_t n);
+
+    Windowing &windowing;
+    vector<Ciphertext> &powers;
+    Evaluator &evaluator;
+    const RelinKeys &relin_keys;
+    // pending_factors[n] is the number of distinct factors of y^n that have
+    // not been computed yet.
+    vector<atomic<size_t>> pending_factors;
+    size_t windows_added;
+    // declared last, so that it waits for the tasks before anything they use
+    // is destroyed.
+    TaskGroup group;
 };
@@ -0,0 +1,206 @@
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "zero_pool.h"
+
+const uint64_t ZERO_POOL_MAGIC = 0x5a45524f504f4f4cull; // 'ZEROPOOL'
+
+ZeroPool::ZeroPool(shared_ptr<SEALContext> context, PublicKey &public_key, size_t capacity, string path)
+    : context(context),
+      encryptor(context, public_key),
+      evaluator(context),
+      key_fingerprint(fingerprint(public_key)),
+      path(path),
+      stats_({0, capacity, 0, 0, 0, 0}),
+      stopping(false)
+{
+    if (!path.empty()) {
+        load();
+    }
+    refill_thread = thread(&ZeroPool::refill, this);
+}
+
+ZeroPool::~ZeroPool()
+{
+    {
+        lock_guard<mutex> lock(zeros_mutex);
+        stopping = true;
+    }
+    zeros_changed.notify_all();
+    refill_thread.join();
+
+    if (!path.empty()) {
+        save();
+    }
+}
+
+void ZeroPool::encrypt(Plaintext &plain, Ciphertext &destination)
+{
+    {
+        unique_lock<mutex> lock(zeros_mutex);
+        if (zeros.empty()) {
+            stats_.misses++;
+        } else {
+            destination = move(zeros.front());
+            zeros.pop_front();
+            stats_.hits++;
+            lock.unlock();
+            zeros_changed.notify_all();
+
+            evaluator.add_plain_inplace(destination, plain);
+            return;
+        }
+    }
+
+    encryptor.encrypt(plain, destination);
+}
+
+void ZeroPool::wait_until_full()
+{
+    unique_lock<mutex> lock(zeros_mutex);
+    zeros_changed.wait(lock, [this] { return zeros.size() >= stats_.capacity; });
+}
+
+ZeroPoolStats ZeroPool::stats()
+{
+    lock_guard<mutex> lock(zeros_mutex);
+    ZeroPoolStats result = stats_;
+    result.size = zeros.size();
+    return result;
+}
+
+void ZeroPool::refill()
+{
+#ifdef __linux__
+    // on linux, nice values apply to individual threads, so this only lowers
+    // the priority of the refill thread.
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+
+    Plaintext zero_plain(1);
+    unique_lock<mutex> lock(zeros_mutex);
+    while (true) {
+        zeros_changed.wait(lock, [this] {
+            return stopping || (zeros.size() < stats_.capacity);
+        });
+        if (stopping) {
+            return;
+        }
+
+        lock.unlock();
+        Ciphertext zero;
+        encryptor.encrypt(zero_plain, zero);
+        lock.lock();
+
+        zeros.push_back(move(zero));
+        stats_.generated++;
+        zeros_changed.notify_all();
+    }
+}
+
+// a path next to path that no other pool, in this or any other process, uses.
+string private_path(const string &path, const char *suffix)
+{
+    static atomic<size_t> counter(0);
+    stringstream result;
+    result << path << suffix;
+#ifndef _WIN32
+    result << "." << getpid();
+#endif
+    result << "." << counter++;
+    return result.str();
+}
+
+void ZeroPool::load()
+{
+    // the file is claimed by renaming it before it's read, so that if several
+    // pools load it at once, only one of them gets its zeros.
+    string claimed_path = private_path(path, ".claimed");
+    if (rename(path.c_str(), claimed_path.c_str()) != 0) {
+        return;
+    }
+    ifstream stream(claimed_path, ios::binary);
+    if (!stream) {
+        remove(claimed_path.c_str());
+        return;
+    }
+
+    uint64_t magic, count;
+    fingerprint_type file_fingerprint;
+    stream.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+    stream.read(reinterpret_cast<char *>(file_fingerprint.data()), sizeof(file_fingerprint));
+    stream.read(reinterpret_cast<char *>(&count), sizeof(count));
+
+    if (stream && (magic == ZERO_POOL_MAGIC) && (file_fingerprint == key_fingerprint)) {
+        try {
+            for (size_t i = 0; i < count; i++) {
+                Ciphertext zero;
+                zero.load(context, stream);
+                zeros.push_back(move(zero));
+            }
+        } catch (...) {
+            // a truncated or otherwise broken file is treated like a missing
+            // one.
+            zeros.clear();
+        }
+    }
+    stats_.loaded = zeros.size();
+
+    stream.close();
+    remove(claimed_path.c_str());
+}
+
+void ZeroPool::save()
+{
+    if (zeros.empty()) {
+        return;
+    }
+
+    // like the key store, we write to a temporary file and then rename it, so
+    // that nobody ever loads a half-written file. the zeros are as sensitive
+    // as the secret key (a zero can be subtracted from the query it was used
+    // for), so the file is created with access for nobody but us, and O_EXCL
+    // makes sure that we don't write through a file or link someone else put
+    // there. if we can't create it, the zeros are dropped.
+    string temporary_path = private_path(path, ".tmp");
+#ifndef _WIN32
+    int file = open(temporary_path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0600);
+    if (file < 0) {
+        zeros.clear();
+        return;
+    }
+    close(file);
+#endif
+    ofstream stream(temporary_path, ios::binary | ios::trunc);
+    uint64_t magic = ZERO_POOL_MAGIC;
+    uint64_t count = zeros.size();
+    stream.write(reinterpret_cast<char *>(&magic), sizeof(magic));
+    stream.write(reinterpret_cast<char *>(key_fingerprint.data()), sizeof(key_fingerprint));
+    stream.write(reinterpret_cast<char *>(&count), sizeof(count));
+    try {
+        for (auto &zero : zeros) {
+            zero.save(stream);
+        }
+    } catch (...) {
+        stream.setstate(ios::failbit);
+    }
+    zeros.clear();
+    stream.close();
+
+    // if anything went wrong, the zeros are dropped.
+    if (!stream || (rename(temporary_path.c_str(), path.c_str()) != 0)) {
+        remove(temporary_path.c_str());
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "seal/seal.h"
+
+#include "fingerprint.h"
+
+using namespace std;
+using namespace seal;
+
+/*
+A ZeroPool holds fresh encryptions of zero under some public key, which are
+precomputed in the background. Adding a plaintext to an encryption of zero is
+cheap and gives a ciphertext that is distributed exactly like a fresh
+encryption of that plaintext, which is expensive to compute, so the receiver can
+do almost all of the work of encrypting its query before it knows the query.
+
+Every encryption of zero must only be used once, since the difference of two
+ciphertexts made from the same zero is an encryption of the difference of their
+plaintexts. The pool hands out each zero at most once. If it is persisted to a
+file, the file is claimed by renaming it before it's loaded, so that of several
+pools that load it at once, only one gets its zeros, and it is rewritten (with
+only the unused zeros) when the pool is destroyed, so a crash can lose zeros,
+but never cause them to be reused.
+
+The pool is refilled by a background thread with the lowest scheduling priority,
+so refilling only takes up CPU time that nothing else wants.
+*/
+
+struct ZeroPoolStats
+{
+    // the number of zeros currently in the pool.
+    size_t size;
+    size_t capacity;
+    // the number of zeros loaded from disk and generated in the background.
+    size_t loaded;
+    size_t generated;
+    // the number of encryptions that did and did not find a zero in the pool.
+    size_t hits;
+    size_t misses;
+};
+
+class ZeroPool
+{
+public:
+    /* if path is not empty, the pool is loaded from (and saved to) that file.
+       zeros in the file are only used if they were made with the same key. */
+    ZeroPool(shared_ptr<SEALContext> context, PublicKey &public_key, size_t capacity, string path = "");
+    ~ZeroPool();
+
+    /* encrypts plain by adding it to a zero from the pool, or with a regular
+       encryption if the pool is empty. safe to call from multiple threads. */
+    void encrypt(Plaintext &plain, Ciphertext &destination);
+    void wait_until_full();
+    ZeroPoolStats stats();
+
+private:
+    void refill();
+    void load();
+    void save();
+
+    shared_ptr<SEALContext> context;
+    Encryptor encryptor;
+    Evaluator evaluator;
+    fingerprint_type key_fingerprint;
+    string path;
+
+    deque<Ciphertext> zeros;
+    ZeroPoolStats stats_;
+    bool stopping;
+    mutex zeros_mutex;
+    condition_variable zeros_changed;
+    thread refill_thread;
+};